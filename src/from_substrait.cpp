@@ -1,6 +1,9 @@
 #include "from_substrait.hpp"
 
 #include "duckdb/common/types/value.hpp"
+#include "duckdb/common/types/column/column_data_collection.hpp"
+#include "duckdb/catalog/catalog.hpp"
+#include "duckdb/catalog/catalog_entry/table_catalog_entry.hpp"
 #include "duckdb/parser/expression/list.hpp"
 #include "duckdb/main/relation/join_relation.hpp"
 #include "duckdb/main/relation/cross_product_relation.hpp"
@@ -11,7 +14,10 @@
 #include "duckdb/main/relation/aggregate_relation.hpp"
 #include "duckdb/main/relation/filter_relation.hpp"
 #include "duckdb/main/relation/order_relation.hpp"
+#include "duckdb/main/relation/query_relation.hpp"
 #include "duckdb/main/connection.hpp"
+#include "duckdb/main/materialized_query_result.hpp"
+#include "duckdb/main/prepared_statement.hpp"
 #include "duckdb/parser/parser.hpp"
 #include "duckdb/common/exception.hpp"
 #include "duckdb/common/helper.hpp"
@@ -20,14 +26,20 @@
 #include "duckdb/common/enums/set_operation_type.hpp"
 
 #include "duckdb/parser/expression/comparison_expression.hpp"
+#include "duckdb/parser/parsed_expression_iterator.hpp"
 
 #include "duckdb/main/client_data.hpp"
+#include "duckdb/main/database_manager.hpp"
 #include "google/protobuf/util/json_util.h"
 #include "substrait/plan.pb.h"
 
 #include "duckdb/main/relation/create_table_relation.hpp"
 #include <duckdb/main/relation/delete_relation.hpp>
 #include "duckdb/main/relation/table_relation.hpp"
+#include "duckdb/parser/query_node/list.hpp"
+#include "duckdb/parser/tableref/list.hpp"
+#include "duckdb/storage/buffer_manager.hpp"
+#include "substrait_virtual_tables.hpp"
 
 namespace duckdb {
 const std::unordered_map<std::string, std::string> SubstraitToDuckDB::function_names_remap = {
@@ -57,36 +69,85 @@ string SubstraitToDuckDB::RemapFunctionName(const string &function_name) {
 	return name;
 }
 
-string SubstraitToDuckDB::RemoveExtension(const string &function_name) {
-	// Lets first drop any extension id
-	string name;
-	for (auto &c : function_name) {
-		if (c == ':') {
-			break;
+const unordered_map<string, SubstraitFunctionKind> SubstraitToDuckDB::function_kinds = {
+    {"and", SubstraitFunctionKind::AND},
+    {"or", SubstraitFunctionKind::OR},
+    {"lt", SubstraitFunctionKind::LT},
+    {"lte", SubstraitFunctionKind::LTE},
+    {"gt", SubstraitFunctionKind::GT},
+    {"gte", SubstraitFunctionKind::GTE},
+    {"equal", SubstraitFunctionKind::EQUAL},
+    {"not_equal", SubstraitFunctionKind::NOT_EQUAL},
+    {"is_null", SubstraitFunctionKind::IS_NULL},
+    {"is_not_null", SubstraitFunctionKind::IS_NOT_NULL},
+    {"not", SubstraitFunctionKind::NOT},
+    {"is_not_distinct_from", SubstraitFunctionKind::IS_NOT_DISTINCT_FROM},
+    {"between", SubstraitFunctionKind::BETWEEN},
+    {"extract", SubstraitFunctionKind::EXTRACT},
+    {"dynamic_parameter", SubstraitFunctionKind::DYNAMIC_PARAMETER}};
+
+//! Anchors beyond this are stored in a map instead of being indexed
+static constexpr uint64_t MAX_DENSE_FUNCTION_ANCHOR = 1 << 16;
+
+void SubstraitToDuckDB::RegisterFunctions() {
+	for (auto &sext : plan.extensions()) {
+		if (!sext.has_extension_function()) {
+			continue;
 		}
-		name += c;
+		auto &sfunc = sext.extension_function();
+		SubstraitFunction function;
+		function.duckdb_name = RemapFunctionName(sfunc.name());
+		function.name = sfunc.name().substr(0, sfunc.name().find(':'));
+		auto kind = function_kinds.find(function.name);
+		if (kind != function_kinds.end()) {
+			function.kind = kind->second;
+		}
+		function.declared = true;
+
+		auto anchor = sfunc.function_anchor();
+		if (anchor >= MAX_DENSE_FUNCTION_ANCHOR) {
+			sparse_functions[anchor] = std::move(function);
+			continue;
+		}
+		if (anchor >= functions.size()) {
+			functions.resize(anchor + 1);
+		}
+		functions[anchor] = std::move(function);
 	}
-	return name;
 }
 
-SubstraitToDuckDB::SubstraitToDuckDB(Connection &con_p, const string &serialized, bool json) : con(con_p) {
+//! The largest first block the arena allocates for a plan
+static constexpr size_t MAX_ARENA_START_BLOCK_SIZE = 16ULL * 1024ULL * 1024ULL;
+
+static google::protobuf::ArenaOptions GetArenaOptions(const string &serialized, bool json) {
+	google::protobuf::ArenaOptions options;
+	// Parsed messages take about twice the size of their binary encoding and less than their JSON encoding,
+	// so the first block fits most plans
+	size_t estimate = json ? serialized.size() : 2 * serialized.size();
+	options.start_block_size =
+	    MaxValue<size_t>(options.start_block_size, MinValue<size_t>(estimate, MAX_ARENA_START_BLOCK_SIZE));
+	options.max_block_size = MaxValue<size_t>(options.max_block_size, options.start_block_size);
+	return options;
+}
+
+SubstraitToDuckDB::SubstraitToDuckDB(const string &serialized, bool json)
+    : arena(make_uniq<google::protobuf::Arena>(GetArenaOptions(serialized, json))),
+      plan(*google::protobuf::Arena::CreateMessage<substrait::Plan>(arena.get())) {
+	// Both parsers read straight from the buffer of the serialized plan, without copying it first
 	if (!json) {
-		if (!plan.ParseFromString(serialized)) {
+		if (serialized.size() > static_cast<size_t>(NumericLimits<int32_t>::Maximum()) ||
+		    !plan.ParseFromArray(serialized.data(), static_cast<int>(serialized.size()))) {
 			throw std::runtime_error("Was not possible to convert binary into Substrait plan");
 		}
 	} else {
-		google::protobuf::util::Status status = google::protobuf::util::JsonStringToMessage(serialized, &plan);
+		google::protobuf::util::Status status = google::protobuf::util::JsonStringToMessage(
+		    google::protobuf::StringPiece(serialized.data(), serialized.size()), &plan);
 		if (!status.ok()) {
 			throw std::runtime_error("Was not possible to convert JSON into Substrait plan: " + status.ToString());
 		}
 	}
 
-	for (auto &sext : plan.extensions()) {
-		if (!sext.has_extension_function()) {
-			continue;
-		}
-		functions_map[sext.extension_function().function_anchor()] = sext.extension_function().name();
-	}
+	RegisterFunctions();
 }
 
 Value TransformLiteralToValue(const substrait::Expression_Literal &literal) {
@@ -164,11 +225,31 @@ unique_ptr<ParsedExpression> SubstraitToDuckDB::TransformLiteralExpr(const subst
 	return make_uniq<ConstantExpression>(TransformLiteralToValue(sexpr.literal()));
 }
 
-unique_ptr<ParsedExpression> SubstraitToDuckDB::TransformSelectionExpr(const substrait::Expression &sexpr) {
-	if (!sexpr.selection().has_direct_reference() || !sexpr.selection().direct_reference().has_struct_field()) {
+static idx_t GetFieldIndex(const substrait::Expression_FieldReference &sref) {
+	if (!sref.has_direct_reference() || !sref.direct_reference().has_struct_field()) {
 		throw InternalException("Can only have direct struct references in selections");
 	}
-	return make_uniq<PositionalReferenceExpression>(sexpr.selection().direct_reference().struct_field().field() + 1);
+	return sref.direct_reference().struct_field().field();
+}
+
+//! The name a column of an outer scope is referenced by
+static string OuterColumnName(idx_t index) {
+	return "outer_column_" + to_string(index);
+}
+
+unique_ptr<ParsedExpression> SubstraitToDuckDB::TransformSelectionExpr(const substrait::Expression &sexpr) {
+	auto &sref = sexpr.selection();
+	if (!sref.has_outer_reference()) {
+		return make_uniq<PositionalReferenceExpression>(GetFieldIndex(sref) + 1);
+	}
+	// Positional references only resolve in the query they are in, outer columns are referenced by name
+	auto steps_out = sref.outer_reference().steps_out();
+	if (steps_out == 0 || steps_out > outer_scopes.size() || !outer_scopes[outer_scopes.size() - steps_out]) {
+		throw NotImplementedException("Outer references are only supported in subqueries of filters and projections");
+	}
+	auto &scope = *outer_scopes[outer_scopes.size() - steps_out];
+	scope.referenced = true;
+	return make_uniq<ColumnRefExpression>(OuterColumnName(GetFieldIndex(sref)), scope.alias);
 }
 
 void SubstraitToDuckDB::VerifyCorrectExtractSubfield(const string &subfield) {
@@ -176,8 +257,7 @@ void SubstraitToDuckDB::VerifyCorrectExtractSubfield(const string &subfield) {
 }
 
 unique_ptr<ParsedExpression> SubstraitToDuckDB::TransformScalarFunctionExpr(const substrait::Expression &sexpr) {
-	auto function_name = FindFunction(sexpr.scalar_function().function_reference());
-	function_name = RemoveExtension(function_name);
+	auto &function = FindFunction(sexpr.scalar_function().function_reference());
 	vector<unique_ptr<ParsedExpression>> children;
 	vector<string> enum_expressions;
 	auto &function_arguments = sexpr.scalar_function().arguments();
@@ -195,21 +275,20 @@ unique_ptr<ParsedExpression> SubstraitToDuckDB::TransformScalarFunctionExpr(cons
 			enum_expressions.push_back(enum_str);
 		}
 	}
-	// string compare galore
-	// TODO simplify this
-	if (function_name == "and") {
+	switch (function.kind) {
+	case SubstraitFunctionKind::AND:
 		return make_uniq<ConjunctionExpression>(ExpressionType::CONJUNCTION_AND, std::move(children));
-	} else if (function_name == "or") {
+	case SubstraitFunctionKind::OR:
 		return make_uniq<ConjunctionExpression>(ExpressionType::CONJUNCTION_OR, std::move(children));
-	} else if (function_name == "lt") {
+	case SubstraitFunctionKind::LT:
 		D_ASSERT(children.size() == 2);
 		return make_uniq<ComparisonExpression>(ExpressionType::COMPARE_LESSTHAN, std::move(children[0]),
 		                                       std::move(children[1]));
-	} else if (function_name == "equal") {
+	case SubstraitFunctionKind::EQUAL:
 		D_ASSERT(children.size() == 2);
 		return make_uniq<ComparisonExpression>(ExpressionType::COMPARE_EQUAL, std::move(children[0]),
 		                                       std::move(children[1]));
-	} else if (function_name == "not_equal") {
+	case SubstraitFunctionKind::NOT_EQUAL: {
 		D_ASSERT(children.size() == 2);
 		// FIXME: We do a not_like if we are doing a string comparison
 		// This is due to substrait not supporting !~~
@@ -229,44 +308,77 @@ unique_ptr<ParsedExpression> SubstraitToDuckDB::TransformScalarFunctionExpr(cons
 			return make_uniq<ComparisonExpression>(ExpressionType::COMPARE_NOTEQUAL, std::move(children[0]),
 			                                       std::move(children[1]));
 		}
-
-	} else if (function_name == "lte") {
+	}
+	case SubstraitFunctionKind::LTE:
 		D_ASSERT(children.size() == 2);
 		return make_uniq<ComparisonExpression>(ExpressionType::COMPARE_LESSTHANOREQUALTO, std::move(children[0]),
 		                                       std::move(children[1]));
-	} else if (function_name == "gte") {
+	case SubstraitFunctionKind::GTE:
 		D_ASSERT(children.size() == 2);
 		return make_uniq<ComparisonExpression>(ExpressionType::COMPARE_GREATERTHANOREQUALTO, std::move(children[0]),
 		                                       std::move(children[1]));
-	} else if (function_name == "gt") {
+	case SubstraitFunctionKind::GT:
 		D_ASSERT(children.size() == 2);
 		return make_uniq<ComparisonExpression>(ExpressionType::COMPARE_GREATERTHAN, std::move(children[0]),
 		                                       std::move(children[1]));
-	} else if (function_name == "is_not_null") {
+	case SubstraitFunctionKind::IS_NOT_NULL:
 		D_ASSERT(children.size() == 1);
 		return make_uniq<OperatorExpression>(ExpressionType::OPERATOR_IS_NOT_NULL, std::move(children[0]));
-	} else if (function_name == "is_null") {
+	case SubstraitFunctionKind::IS_NULL:
 		D_ASSERT(children.size() == 1);
 		return make_uniq<OperatorExpression>(ExpressionType::OPERATOR_IS_NULL, std::move(children[0]));
-	} else if (function_name == "not") {
+	case SubstraitFunctionKind::NOT:
 		D_ASSERT(children.size() == 1);
 		return make_uniq<OperatorExpression>(ExpressionType::OPERATOR_NOT, std::move(children[0]));
-	} else if (function_name == "is_not_distinct_from") {
+	case SubstraitFunctionKind::IS_NOT_DISTINCT_FROM:
 		D_ASSERT(children.size() == 2);
 		return make_uniq<ComparisonExpression>(ExpressionType::COMPARE_NOT_DISTINCT_FROM, std::move(children[0]),
 		                                       std::move(children[1]));
-	} else if (function_name == "between") {
+	case SubstraitFunctionKind::BETWEEN:
 		D_ASSERT(children.size() == 3);
 		return make_uniq<BetweenExpression>(std::move(children[0]), std::move(children[1]), std::move(children[2]));
-	} else if (function_name == "extract") {
+	case SubstraitFunctionKind::EXTRACT: {
 		D_ASSERT(enum_expressions.size() == 1);
 		auto &subfield = enum_expressions[0];
 		VerifyCorrectExtractSubfield(subfield);
 		auto constant_expression = make_uniq<ConstantExpression>(Value(subfield));
 		children.insert(children.begin(), std::move(constant_expression));
+		break;
+	}
+	case SubstraitFunctionKind::DYNAMIC_PARAMETER:
+		return TransformDynamicParameter(children);
+	default:
+		break;
 	}
 
-	return make_uniq<FunctionExpression>(RemapFunctionName(function_name), std::move(children));
+	return make_uniq<FunctionExpression>(function.duckdb_name, std::move(children));
+}
+
+unique_ptr<ParsedExpression>
+SubstraitToDuckDB::TransformDynamicParameter(vector<unique_ptr<ParsedExpression>> &children) {
+	// The bundled Substrait version has no dynamic parameter expression, a placeholder is written as a call to the
+	// dynamic_parameter function with the zero-based index of the parameter as its only argument
+	if (children.size() != 1 || children[0]->GetExpressionClass() != ExpressionClass::CONSTANT) {
+		throw InvalidInputException("dynamic_parameter expects the index of the parameter as its only argument");
+	}
+	auto &index_value = children[0]->Cast<ConstantExpression>().value;
+	if (index_value.IsNull() || !index_value.type().IsIntegral() || index_value.GetValue<int64_t>() < 0) {
+		throw InvalidInputException("dynamic_parameter expects a non-negative integer index");
+	}
+	if (!dynamic_parameters_allowed) {
+		// A plan that is executed right away has no values for its parameters
+		throw NotImplementedException("Plans with dynamic parameters can only be executed with substrait_prepare");
+	}
+	if (con) {
+		// Relations are bound while they are created, before any parameter has a value
+		throw NotImplementedException("Dynamic parameters are not supported in plans that write or that have nested "
+		                              "output names");
+	}
+	auto index = index_value.GetValue<idx_t>();
+	parameter_count = MaxValue<idx_t>(parameter_count, index + 1);
+	auto parameter = make_uniq<ParameterExpression>();
+	parameter->identifier = to_string(index + 1);
+	return std::move(parameter);
 }
 
 unique_ptr<ParsedExpression> SubstraitToDuckDB::TransformIfThenExpr(const substrait::Expression &sexpr) {
@@ -358,6 +470,197 @@ unique_ptr<ParsedExpression> SubstraitToDuckDB::TransformNested(const substrait:
 	}
 }
 
+//! Transform a bound of a Substrait window frame, the lower bound is the start of the frame and the upper bound its end
+static void TransformWindowBound(const substrait::Expression_WindowFunction_Bound &sbound, bool is_lower, bool rows,
+                                 WindowBoundary &boundary, unique_ptr<ParsedExpression> &offset) {
+	switch (sbound.kind_case()) {
+	case substrait::Expression_WindowFunction_Bound::kPreceding:
+		boundary = rows ? WindowBoundary::EXPR_PRECEDING_ROWS : WindowBoundary::EXPR_PRECEDING_RANGE;
+		offset = make_uniq<ConstantExpression>(Value::BIGINT(sbound.preceding().offset()));
+		break;
+	case substrait::Expression_WindowFunction_Bound::kFollowing:
+		boundary = rows ? WindowBoundary::EXPR_FOLLOWING_ROWS : WindowBoundary::EXPR_FOLLOWING_RANGE;
+		offset = make_uniq<ConstantExpression>(Value::BIGINT(sbound.following().offset()));
+		break;
+	case substrait::Expression_WindowFunction_Bound::kCurrentRow:
+		boundary = rows ? WindowBoundary::CURRENT_ROW_ROWS : WindowBoundary::CURRENT_ROW_RANGE;
+		break;
+	case substrait::Expression_WindowFunction_Bound::kUnbounded:
+		boundary = is_lower ? WindowBoundary::UNBOUNDED_PRECEDING : WindowBoundary::UNBOUNDED_FOLLOWING;
+		break;
+	default:
+		throw NotImplementedException("Unsupported window bound " + to_string(sbound.kind_case()));
+	}
+}
+
+template <class T>
+unique_ptr<ParsedExpression>
+SubstraitToDuckDB::TransformWindowFunction(const T &swindow,
+                                           const google::protobuf::RepeatedPtrField<substrait::Expression> &partitions,
+                                           const google::protobuf::RepeatedPtrField<substrait::SortField> &sorts) {
+	vector<unique_ptr<ParsedExpression>> children;
+	for (auto &sarg : swindow.arguments()) {
+		children.push_back(TransformExpr(sarg.value()));
+	}
+	auto &function = FindFunction(swindow.function_reference());
+	auto function_name = function.duckdb_name;
+	if (function.name == "count" && children.empty()) {
+		function_name = "count_star";
+	}
+	auto type = WindowExpression::WindowToExpressionType(function_name);
+	auto result = make_uniq<WindowExpression>(type, INVALID_CATALOG, INVALID_SCHEMA, function_name);
+	switch (type) {
+	case ExpressionType::WINDOW_AGGREGATE:
+		result->distinct = swindow.invocation() ==
+		                   substrait::AggregateFunction_AggregationInvocation_AGGREGATION_INVOCATION_DISTINCT;
+		result->children = std::move(children);
+		break;
+	case ExpressionType::WINDOW_LEAD:
+	case ExpressionType::WINDOW_LAG:
+	case ExpressionType::WINDOW_NTH_VALUE:
+		// The offset and the default are arguments in Substrait but separate expressions in DuckDB
+		for (idx_t i = 0; i < children.size(); i++) {
+			if (i == 0) {
+				result->children.push_back(std::move(children[i]));
+			} else if (i == 1) {
+				result->offset_expr = std::move(children[i]);
+			} else if (i == 2 && type != ExpressionType::WINDOW_NTH_VALUE) {
+				result->default_expr = std::move(children[i]);
+			} else {
+				throw InvalidInputException("Too many arguments for window function %s", function_name);
+			}
+		}
+		break;
+	default:
+		result->children = std::move(children);
+		break;
+	}
+	for (auto &spartition : partitions) {
+		result->partitions.push_back(TransformExpr(spartition));
+	}
+	for (auto &sordf : sorts) {
+		result->orders.push_back(TransformOrder(sordf));
+	}
+
+	// Substrait frames are RANGE frames unless they are ROWS frames, as in SQL
+	auto rows = swindow.bounds_type() == substrait::Expression_WindowFunction_BoundsType_BOUNDS_TYPE_ROWS;
+	result->start = WindowBoundary::UNBOUNDED_PRECEDING;
+	if (swindow.has_lower_bound()) {
+		TransformWindowBound(swindow.lower_bound(), true, rows, result->start, result->start_expr);
+	}
+	if (swindow.has_upper_bound()) {
+		TransformWindowBound(swindow.upper_bound(), false, rows, result->end, result->end_expr);
+	} else if (sorts.empty()) {
+		result->end = WindowBoundary::UNBOUNDED_FOLLOWING;
+	} else {
+		result->end = rows ? WindowBoundary::CURRENT_ROW_ROWS : WindowBoundary::CURRENT_ROW_RANGE;
+	}
+	return std::move(result);
+}
+
+unique_ptr<ParsedExpression> SubstraitToDuckDB::TransformWindowFunctionExpr(const substrait::Expression &sexpr) {
+	auto &swindow = sexpr.window_function();
+	return TransformWindowFunction(swindow, swindow.partitions(), swindow.sorts());
+}
+
+SubstraitOuterScope SubstraitToDuckDB::CreateOuterScope() {
+	return SubstraitOuterScope("outer_" + to_string(scope_count++));
+}
+
+unique_ptr<SelectStatement> SubstraitToDuckDB::TransformSubquery(const substrait::Rel &sop) {
+	outer_scopes.push_back(operator_scope);
+	auto enclosing_scope = operator_scope;
+	operator_scope = nullptr;
+	auto result = make_uniq<SelectStatement>();
+	result->node = TransformNode(sop);
+	operator_scope = enclosing_scope;
+	outer_scopes.pop_back();
+	return result;
+}
+
+static ExpressionType TransformSetComparisonType(substrait::Expression_Subquery_SetComparison_ComparisonOp op) {
+	switch (op) {
+	case substrait::Expression_Subquery_SetComparison_ComparisonOp_COMPARISON_OP_EQ:
+		return ExpressionType::COMPARE_EQUAL;
+	case substrait::Expression_Subquery_SetComparison_ComparisonOp_COMPARISON_OP_NE:
+		return ExpressionType::COMPARE_NOTEQUAL;
+	case substrait::Expression_Subquery_SetComparison_ComparisonOp_COMPARISON_OP_LT:
+		return ExpressionType::COMPARE_LESSTHAN;
+	case substrait::Expression_Subquery_SetComparison_ComparisonOp_COMPARISON_OP_GT:
+		return ExpressionType::COMPARE_GREATERTHAN;
+	case substrait::Expression_Subquery_SetComparison_ComparisonOp_COMPARISON_OP_LE:
+		return ExpressionType::COMPARE_LESSTHANOREQUALTO;
+	case substrait::Expression_Subquery_SetComparison_ComparisonOp_COMPARISON_OP_GE:
+		return ExpressionType::COMPARE_GREATERTHANOREQUALTO;
+	default:
+		throw NotImplementedException("Unsupported set comparison " + to_string(op));
+	}
+}
+
+unique_ptr<ParsedExpression> SubstraitToDuckDB::TransformSubqueryExpr(const substrait::Expression &sexpr) {
+	auto &ssubquery = sexpr.subquery();
+	auto result = make_uniq<SubqueryExpression>();
+	switch (ssubquery.subquery_type_case()) {
+	case substrait::Expression_Subquery::kScalar:
+		result->subquery_type = SubqueryType::SCALAR;
+		result->subquery = TransformSubquery(ssubquery.scalar().input());
+		return std::move(result);
+	case substrait::Expression_Subquery::kInPredicate: {
+		auto &sin = ssubquery.in_predicate();
+		result->subquery_type = SubqueryType::ANY;
+		result->comparison_type = ExpressionType::COMPARE_EQUAL;
+		result->subquery = TransformSubquery(sin.haystack());
+		if (sin.needles_size() == 1) {
+			result->child = TransformExpr(sin.needles(0));
+			return std::move(result);
+		}
+		// DuckDB compares a single column with the rows of a subquery, so multiple needles are compared as a struct
+		vector<unique_ptr<ParsedExpression>> needles, columns;
+		for (auto &sneedle : sin.needles()) {
+			needles.push_back(TransformExpr(sneedle));
+			columns.push_back(make_uniq<PositionalReferenceExpression>(columns.size() + 1));
+		}
+		result->child = make_uniq<FunctionExpression>("row", std::move(needles));
+		auto haystack = make_uniq<SelectNode>();
+		haystack->select_list.push_back(make_uniq<FunctionExpression>("row", std::move(columns)));
+		haystack->from_table = make_uniq<SubqueryRef>(std::move(result->subquery), "haystack");
+		result->subquery = make_uniq<SelectStatement>();
+		result->subquery->node = std::move(haystack);
+		return std::move(result);
+	}
+	case substrait::Expression_Subquery::kSetPredicate:
+		if (ssubquery.set_predicate().predicate_op() !=
+		    substrait::Expression_Subquery_SetPredicate_PredicateOp_PREDICATE_OP_EXISTS) {
+			throw NotImplementedException("Unsupported set predicate " +
+			                              to_string(ssubquery.set_predicate().predicate_op()));
+		}
+		result->subquery_type = SubqueryType::EXISTS;
+		result->subquery = TransformSubquery(ssubquery.set_predicate().tuples());
+		return std::move(result);
+	case substrait::Expression_Subquery::kSetComparison: {
+		auto &scomparison = ssubquery.set_comparison();
+		auto comparison_type = TransformSetComparisonType(scomparison.comparison_op());
+		result->subquery_type = SubqueryType::ANY;
+		result->child = TransformExpr(scomparison.left());
+		result->subquery = TransformSubquery(scomparison.right());
+		switch (scomparison.reduction_op()) {
+		case substrait::Expression_Subquery_SetComparison_ReductionOp_REDUCTION_OP_ANY:
+			result->comparison_type = comparison_type;
+			return std::move(result);
+		case substrait::Expression_Subquery_SetComparison_ReductionOp_REDUCTION_OP_ALL:
+			// x op ALL (subquery) is NOT (x negated-op ANY (subquery)), as DuckDB's own transformer writes it
+			result->comparison_type = NegateComparisonExpression(comparison_type);
+			return make_uniq<OperatorExpression>(ExpressionType::OPERATOR_NOT, std::move(result));
+		default:
+			throw NotImplementedException("Unsupported set comparison reduction " +
+			                              to_string(scomparison.reduction_op()));
+		}
+	}
+	default:
+		throw NotImplementedException("Unsupported subquery type " + to_string(ssubquery.subquery_type_case()));
+	}
+}
+
 unique_ptr<ParsedExpression> SubstraitToDuckDB::TransformExpr(const substrait::Expression &sexpr) {
 	switch (sexpr.rex_type_case()) {
 	case substrait::Expression::RexTypeCase::kLiteral:
@@ -374,17 +677,24 @@ unique_ptr<ParsedExpression> SubstraitToDuckDB::TransformExpr(const substrait::E
 		return TransformInExpr(sexpr);
 	case substrait::Expression::RexTypeCase::kNested:
 		return TransformNested(sexpr);
+	case substrait::Expression::RexTypeCase::kWindowFunction:
+		return TransformWindowFunctionExpr(sexpr);
 	case substrait::Expression::RexTypeCase::kSubquery:
+		return TransformSubqueryExpr(sexpr);
 	default:
 		throw InternalException("Unsupported expression type " + to_string(sexpr.rex_type_case()));
 	}
 }
 
-string SubstraitToDuckDB::FindFunction(uint64_t id) {
-	if (functions_map.find(id) == functions_map.end()) {
-		throw InternalException("Could not find aggregate function " + to_string(id));
+const SubstraitFunction &SubstraitToDuckDB::FindFunction(uint64_t id) {
+	if (id < functions.size() && functions[id].declared) {
+		return functions[id];
+	}
+	auto entry = sparse_functions.find(id);
+	if (entry == sparse_functions.end()) {
+		throw InternalException("Could not find function " + to_string(id));
 	}
-	return functions_map[id];
+	return entry->second;
 }
 
 OrderByNode SubstraitToDuckDB::TransformOrder(const substrait::SortField &sordf) {
@@ -416,38 +726,198 @@ OrderByNode SubstraitToDuckDB::TransformOrder(const substrait::SortField &sordf)
 	return {dordertype, dnullorder, TransformExpr(sordf.expr())};
 }
 
-shared_ptr<Relation> SubstraitToDuckDB::TransformJoinOp(const substrait::Rel &sop) {
-	auto &sjoin = sop.join();
-
-	JoinType djointype;
+static JoinType TransformJoinType(const substrait::JoinRel &sjoin) {
 	switch (sjoin.type()) {
 	case substrait::JoinRel::JoinType::JoinRel_JoinType_JOIN_TYPE_INNER:
-		djointype = JoinType::INNER;
-		break;
+		return JoinType::INNER;
 	case substrait::JoinRel::JoinType::JoinRel_JoinType_JOIN_TYPE_LEFT:
-		djointype = JoinType::LEFT;
-		break;
+		return JoinType::LEFT;
 	case substrait::JoinRel::JoinType::JoinRel_JoinType_JOIN_TYPE_RIGHT:
-		djointype = JoinType::RIGHT;
-		break;
+		return JoinType::RIGHT;
 	case substrait::JoinRel::JoinType::JoinRel_JoinType_JOIN_TYPE_SINGLE:
-		djointype = JoinType::SINGLE;
-		break;
+		return JoinType::SINGLE;
 	case substrait::JoinRel::JoinType::JoinRel_JoinType_JOIN_TYPE_SEMI:
-		djointype = JoinType::SEMI;
-		break;
+		return JoinType::SEMI;
 	case substrait::JoinRel::JoinType::JoinRel_JoinType_JOIN_TYPE_OUTER:
-		djointype = JoinType::OUTER;
-		break;
+		return JoinType::OUTER;
 	default:
 		throw InternalException("Unsupported join type");
 	}
+}
+
+shared_ptr<Relation> SubstraitToDuckDB::TransformJoinOp(const substrait::Rel &sop) {
+	auto &sjoin = sop.join();
+	auto djointype = TransformJoinType(sjoin);
 	unique_ptr<ParsedExpression> join_condition = TransformExpr(sjoin.expression());
 	return make_shared_ptr<JoinRelation>(TransformOp(sjoin.left())->Alias("left"),
 	                                     TransformOp(sjoin.right())->Alias("right"), std::move(join_condition),
 	                                     djointype);
 }
 
+template <class T>
+static JoinType TransformPhysicalJoinType(typename T::JoinType type, bool &swap_inputs) {
+	swap_inputs = false;
+	switch (type) {
+	case T::JOIN_TYPE_INNER:
+		return JoinType::INNER;
+	case T::JOIN_TYPE_OUTER:
+		return JoinType::OUTER;
+	case T::JOIN_TYPE_LEFT:
+		return JoinType::LEFT;
+	case T::JOIN_TYPE_RIGHT:
+		return JoinType::RIGHT;
+	case T::JOIN_TYPE_LEFT_SEMI:
+		return JoinType::SEMI;
+	case T::JOIN_TYPE_LEFT_ANTI:
+		return JoinType::ANTI;
+	case T::JOIN_TYPE_RIGHT_SEMI:
+		// DuckDB only has semi and anti joins that return the left input
+		swap_inputs = true;
+		return JoinType::SEMI;
+	case T::JOIN_TYPE_RIGHT_ANTI:
+		swap_inputs = true;
+		return JoinType::ANTI;
+	default:
+		throw InternalException("Unsupported join type");
+	}
+}
+
+static ExpressionType TransformJoinComparison(const substrait::ComparisonJoinKey_ComparisonType &scomparison) {
+	if (scomparison.inner_type_case() != substrait::ComparisonJoinKey_ComparisonType::kSimple) {
+		throw NotImplementedException("Join keys compared with a custom function are not supported");
+	}
+	switch (scomparison.simple()) {
+	case substrait::ComparisonJoinKey_SimpleComparisonType_SIMPLE_COMPARISON_TYPE_EQ:
+		return ExpressionType::COMPARE_EQUAL;
+	case substrait::ComparisonJoinKey_SimpleComparisonType_SIMPLE_COMPARISON_TYPE_IS_NOT_DISTINCT_FROM:
+		return ExpressionType::COMPARE_NOT_DISTINCT_FROM;
+	default:
+		throw NotImplementedException("Unsupported join key comparison " + to_string(scomparison.simple()));
+	}
+}
+
+//! Rewrites a condition over the columns of (left, right) into one over the columns of (right, left)
+static void SwapJoinInputs(ParsedExpression &expr, idx_t left_column_count, idx_t right_column_count) {
+	if (expr.GetExpressionClass() == ExpressionClass::POSITIONAL_REFERENCE) {
+		auto &reference = expr.Cast<PositionalReferenceExpression>();
+		if (reference.index <= left_column_count) {
+			reference.index += right_column_count;
+		} else {
+			reference.index -= left_column_count;
+		}
+		return;
+	}
+	ParsedExpressionIterator::EnumerateChildren(
+	    expr, [&](ParsedExpression &child) { SwapJoinInputs(child, left_column_count, right_column_count); });
+}
+
+template <class T>
+unique_ptr<ParsedExpression> SubstraitToDuckDB::TransformJoinKeys(const T &sjoin) {
+	// The keys reference the columns of their own input, the condition references the columns of both
+	auto left_column_count = GetColumnCount(sjoin.left());
+	vector<unique_ptr<ParsedExpression>> conditions;
+	for (auto &skey : sjoin.keys()) {
+		auto left = make_uniq<PositionalReferenceExpression>(GetFieldIndex(skey.left()) + 1);
+		auto right = make_uniq<PositionalReferenceExpression>(left_column_count + GetFieldIndex(skey.right()) + 1);
+		conditions.push_back(make_uniq<ComparisonExpression>(TransformJoinComparison(skey.comparison()),
+		                                                     std::move(left), std::move(right)));
+	}
+	if (sjoin.keys_size() == 0) {
+		// Producers of older Substrait versions set the deprecated key pairs instead, which are compared for equality
+		if (sjoin.left_keys_size() != sjoin.right_keys_size()) {
+			throw InvalidInputException("The join has %d left keys, but %d right keys", sjoin.left_keys_size(),
+			                            sjoin.right_keys_size());
+		}
+		for (int i = 0; i < sjoin.left_keys_size(); i++) {
+			auto left = make_uniq<PositionalReferenceExpression>(GetFieldIndex(sjoin.left_keys(i)) + 1);
+			auto right =
+			    make_uniq<PositionalReferenceExpression>(left_column_count + GetFieldIndex(sjoin.right_keys(i)) + 1);
+			conditions.push_back(make_uniq<ComparisonExpression>(ExpressionType::COMPARE_EQUAL, std::move(left),
+			                                                     std::move(right)));
+		}
+	}
+	if (sjoin.has_post_join_filter()) {
+		conditions.push_back(TransformExpr(sjoin.post_join_filter()));
+	}
+	if (conditions.empty()) {
+		throw InvalidInputException("A hash or merge join needs at least one key");
+	}
+	if (conditions.size() == 1) {
+		return std::move(conditions[0]);
+	}
+	return make_uniq<ConjunctionExpression>(ExpressionType::CONJUNCTION_AND, std::move(conditions));
+}
+
+//! The name of the join strategy a physical join asks for
+static string PhysicalJoinName(const substrait::Rel &sop) {
+	switch (sop.rel_type_case()) {
+	case substrait::Rel::RelTypeCase::kHashJoin:
+		return "hash join";
+	case substrait::Rel::RelTypeCase::kMergeJoin:
+		return "merge join";
+	default:
+		return "nested loop join";
+	}
+}
+
+SubstraitPhysicalJoin SubstraitToDuckDB::TransformPhysicalJoin(const substrait::Rel &sop) {
+	// DuckDB can't be told which strategy or build side to join with, the logical join is planned again by its own
+	// optimizer, which the caller has to allow
+	if (!physical_join_replanning_allowed) {
+		throw NotImplementedException("The plan asks for a %s, but DuckDB picks its own join strategy and build side, "
+		                              "SET substrait_replan_physical_joins=true to let it plan the join",
+		                              PhysicalJoinName(sop));
+	}
+	has_physical_joins = true;
+	SubstraitPhysicalJoin result;
+	bool swap_inputs;
+	switch (sop.rel_type_case()) {
+	case substrait::Rel::RelTypeCase::kHashJoin: {
+		auto &sjoin = sop.hash_join();
+		result.left = &sjoin.left();
+		result.right = &sjoin.right();
+		result.type = TransformPhysicalJoinType<substrait::HashJoinRel>(sjoin.type(), swap_inputs);
+		result.condition = TransformJoinKeys(sjoin);
+		break;
+	}
+	case substrait::Rel::RelTypeCase::kMergeJoin: {
+		auto &sjoin = sop.merge_join();
+		result.left = &sjoin.left();
+		result.right = &sjoin.right();
+		result.type = TransformPhysicalJoinType<substrait::MergeJoinRel>(sjoin.type(), swap_inputs);
+		result.condition = TransformJoinKeys(sjoin);
+		break;
+	}
+	case substrait::Rel::RelTypeCase::kNestedLoopJoin: {
+		auto &sjoin = sop.nested_loop_join();
+		result.left = &sjoin.left();
+		result.right = &sjoin.right();
+		result.type = TransformPhysicalJoinType<substrait::NestedLoopJoinRel>(sjoin.type(), swap_inputs);
+		if (sjoin.has_expression()) {
+			result.condition = TransformExpr(sjoin.expression());
+		} else {
+			// joins all pairs of rows
+			result.condition = make_uniq<ConstantExpression>(Value::BOOLEAN(true));
+		}
+		break;
+	}
+	default:
+		throw InternalException("Unsupported physical join " + to_string(sop.rel_type_case()));
+	}
+	if (swap_inputs) {
+		SwapJoinInputs(*result.condition, GetColumnCount(*result.left), GetColumnCount(*result.right));
+		std::swap(result.left, result.right);
+	}
+	return result;
+}
+
+shared_ptr<Relation> SubstraitToDuckDB::TransformPhysicalJoinOp(const substrait::Rel &sop) {
+	auto join = TransformPhysicalJoin(sop);
+	auto left = TransformOp(*join.left)->Alias("left");
+	auto right = TransformOp(*join.right)->Alias("right");
+	return make_shared_ptr<JoinRelation>(std::move(left), std::move(right), std::move(join.condition), join.type);
+}
+
 shared_ptr<Relation> SubstraitToDuckDB::TransformCrossProductOp(const substrait::Rel &sop) {
 	auto &sub_cross = sop.cross();
 
@@ -462,38 +932,280 @@ shared_ptr<Relation> SubstraitToDuckDB::TransformFetchOp(const substrait::Rel &s
 	return make_shared_ptr<LimitRelation>(TransformOp(slimit.input()), limit, offset);
 }
 
+shared_ptr<Relation> SubstraitToDuckDB::ToScopeRelation(shared_ptr<Relation> input, const SubstraitOuterScope &scope) {
+	if (!scope.referenced) {
+		return input;
+	}
+	vector<unique_ptr<ParsedExpression>> columns;
+	vector<string> aliases;
+	for (idx_t i = 0; i < input->Columns().size(); i++) {
+		columns.push_back(make_uniq<PositionalReferenceExpression>(i + 1));
+		aliases.push_back(OuterColumnName(i));
+	}
+	return make_shared_ptr<ProjectionRelation>(std::move(input), std::move(columns), std::move(aliases))
+	    ->Alias(scope.alias);
+}
+
 shared_ptr<Relation> SubstraitToDuckDB::TransformFilterOp(const substrait::Rel &sop) {
 	auto &sfilter = sop.filter();
-	return make_shared_ptr<FilterRelation>(TransformOp(sfilter.input()), TransformExpr(sfilter.condition()));
+	auto scope = CreateOuterScope();
+	operator_scope = &scope;
+	auto condition = TransformExpr(sfilter.condition());
+	operator_scope = nullptr;
+	return make_shared_ptr<FilterRelation>(ToScopeRelation(TransformOp(sfilter.input()), scope), std::move(condition));
 }
 
 shared_ptr<Relation> SubstraitToDuckDB::TransformProjectOp(const substrait::Rel &sop) {
+	auto scope = CreateOuterScope();
+	operator_scope = &scope;
 	vector<unique_ptr<ParsedExpression>> expressions;
 	for (auto &sexpr : sop.project().expressions()) {
 		expressions.push_back(TransformExpr(sexpr));
 	}
+	operator_scope = nullptr;
 
 	vector<string> mock_aliases;
 	for (size_t i = 0; i < expressions.size(); i++) {
 		mock_aliases.push_back("expr_" + to_string(i));
 	}
-	return make_shared_ptr<ProjectionRelation>(TransformOp(sop.project().input()), std::move(expressions),
-	                                           std::move(mock_aliases));
+	return make_shared_ptr<ProjectionRelation>(ToScopeRelation(TransformOp(sop.project().input()), scope),
+	                                           std::move(expressions), std::move(mock_aliases));
 }
 
-shared_ptr<Relation> SubstraitToDuckDB::TransformAggregateOp(const substrait::Rel &sop) {
-	vector<unique_ptr<ParsedExpression>> groups, expressions;
+//! The expressions of the groupings of an aggregate, each expression once in the order it first appears in
+class SubstraitGroupingExpressions {
+public:
+	explicit SubstraitGroupingExpressions(const substrait::AggregateRel &saggr) {
+		for (auto &sgrp : saggr.groupings()) {
+			for (auto &sexpr : sgrp.grouping_expressions()) {
+				auto serialized = sexpr.SerializeAsString();
+				if (indexes.find(serialized) == indexes.end()) {
+					indexes[serialized] = expressions.size();
+					expressions.push_back(sexpr);
+				}
+			}
+		}
+	}
+
+	idx_t GetIndex(const substrait::Expression &sexpr) const {
+		return indexes.at(sexpr.SerializeAsString());
+	}
+
+	vector<reference<const substrait::Expression>> expressions;
+
+private:
+	unordered_map<string, idx_t> indexes;
+};
+
+//! A bitmask with a bit for every grouping expression that is not part of the grouping set, as GROUPING() returns it
+static idx_t GetGroupingMask(const GroupingSet &grouping_set, idx_t expression_count) {
+	idx_t mask = 0;
+	for (idx_t i = 0; i < expression_count; i++) {
+		if (grouping_set.find(i) == grouping_set.end()) {
+			mask |= idx_t(1) << (expression_count - 1 - i);
+		}
+	}
+	return mask;
+}
+
+//! Aggregates whose partial results are combined by aggregating them again with the same function
+static const case_insensitive_set_t SELF_COMBINING_AGGREGATES = {"sum", "min", "max", "bool_and", "bool_or"};
+
+static unique_ptr<ParsedExpression> PartialAggregate(const string &function_name, unique_ptr<ParsedExpression> child,
+                                                     const unique_ptr<ParsedExpression> &filter) {
+	vector<unique_ptr<ParsedExpression>> children;
+	children.push_back(std::move(child));
+	return make_uniq<FunctionExpression>(function_name, std::move(children), filter ? filter->Copy() : nullptr);
+}
+
+//! The partial results of an average, a struct of the sum and the count of its input
+static unique_ptr<ParsedExpression> PartialAverage(unique_ptr<ParsedExpression> sum,
+                                                   unique_ptr<ParsedExpression> count) {
+	sum->alias = "sum";
+	count->alias = "count";
+	vector<unique_ptr<ParsedExpression>> children;
+	children.push_back(std::move(sum));
+	children.push_back(std::move(count));
+	return make_uniq<FunctionExpression>("struct_pack", std::move(children));
+}
+
+//! Combined counts are sums, which are NULL rather than 0 for no input and wider than a count
+static unique_ptr<ParsedExpression> CombinedCount(unique_ptr<ParsedExpression> sum) {
+	auto count = make_uniq<OperatorExpression>(ExpressionType::OPERATOR_COALESCE, std::move(sum),
+	                                           make_uniq<ConstantExpression>(Value::BIGINT(0)));
+	return make_uniq<CastExpression>(LogicalType::BIGINT, std::move(count));
+}
+
+static unique_ptr<ParsedExpression> ExtractField(unique_ptr<ParsedExpression> state, const string &field) {
+	vector<unique_ptr<ParsedExpression>> children;
+	children.push_back(std::move(state));
+	children.push_back(make_uniq<ConstantExpression>(Value(field)));
+	return make_uniq<FunctionExpression>("struct_extract", std::move(children));
+}
+
+//! Transform an aggregate of a phase of a distributed aggregation. Partial results are values of regular types,
+//! structs for averages, so they can be exported from one process and combined in another
+static unique_ptr<ParsedExpression> TransformAggregatePhase(const string &function_name,
+                                                            substrait::AggregationPhase phase,
+                                                            vector<unique_ptr<ParsedExpression>> children,
+                                                            const unique_ptr<ParsedExpression> &filter) {
+	if (phase == substrait::AGGREGATION_PHASE_INITIAL_TO_INTERMEDIATE) {
+		if (function_name == "avg" && children.size() == 1) {
+			auto sum = PartialAggregate("sum", children[0]->Copy(), filter);
+			return PartialAverage(std::move(sum), PartialAggregate("count", std::move(children[0]), filter));
+		}
+		if (SELF_COMBINING_AGGREGATES.count(function_name) || function_name == "count" ||
+		    function_name == "count_star") {
+			return make_uniq<FunctionExpression>(function_name, std::move(children), filter ? filter->Copy() : nullptr);
+		}
+		throw NotImplementedException("The aggregate %s can't be computed in phases", function_name);
+	}
+	// The intermediate phases aggregate the partial results of the previous phase, given as the only argument
+	if (children.size() != 1) {
+		throw InvalidInputException("The aggregate %s takes the partial results it combines as its only argument",
+		                            function_name);
+	}
+	auto &state = children[0];
+	if (SELF_COMBINING_AGGREGATES.count(function_name)) {
+		return PartialAggregate(function_name, std::move(state), filter);
+	}
+	if (function_name == "count") {
+		return CombinedCount(PartialAggregate("sum", std::move(state), filter));
+	}
+	if (function_name == "avg") {
+		auto sum = PartialAggregate("sum", ExtractField(state->Copy(), "sum"), filter);
+		auto count = PartialAggregate("sum", ExtractField(std::move(state), "count"), filter);
+		if (phase == substrait::AGGREGATION_PHASE_INTERMEDIATE_TO_RESULT) {
+			vector<unique_ptr<ParsedExpression>> operands;
+			operands.push_back(std::move(sum));
+			operands.push_back(std::move(count));
+			return make_uniq<FunctionExpression>("/", std::move(operands), nullptr, nullptr, false, true);
+		}
+		return PartialAverage(std::move(sum), CombinedCount(std::move(count)));
+	}
+	throw NotImplementedException("The aggregate %s can't be computed in phases", function_name);
+}
+
+//! Whether the partial results of an aggregation phase are passed on to another phase, in the types the plan
+//! declares for them
+static bool HasIntermediateResult(substrait::AggregationPhase phase) {
+	return phase == substrait::AGGREGATION_PHASE_INITIAL_TO_INTERMEDIATE ||
+	       phase == substrait::AGGREGATION_PHASE_INTERMEDIATE_TO_INTERMEDIATE;
+}
+
+static bool DeclaresIntermediateTypes(const substrait::AggregateRel &saggr) {
+	for (auto &smeas : saggr.measures()) {
+		if (HasIntermediateResult(smeas.measure().phase()) && smeas.measure().has_output_type()) {
+			return true;
+		}
+	}
+	return false;
+}
 
-	if (sop.aggregate().groupings_size() > 0) {
-		for (auto &sgrp : sop.aggregate().groupings()) {
-			for (auto &sgrpexpr : sgrp.grouping_expressions()) {
-				groups.push_back(TransformExpr(sgrpexpr));
-				expressions.push_back(TransformExpr(sgrpexpr));
+//! Whether a DuckDB type is the Substrait type, types without a Substrait counterpart (e.g. HUGEINT) are none
+static bool IsSubstraitType(const LogicalType &type, const substrait::Type &stype) {
+	switch (stype.kind_case()) {
+	case substrait::Type::KindCase::kBool:
+		return type.id() == LogicalTypeId::BOOLEAN;
+	case substrait::Type::KindCase::kI8:
+		return type.id() == LogicalTypeId::TINYINT;
+	case substrait::Type::KindCase::kI16:
+		return type.id() == LogicalTypeId::SMALLINT;
+	case substrait::Type::KindCase::kI32:
+		return type.id() == LogicalTypeId::INTEGER;
+	case substrait::Type::KindCase::kI64:
+		return type.id() == LogicalTypeId::BIGINT;
+	case substrait::Type::KindCase::kFp32:
+		return type.id() == LogicalTypeId::FLOAT;
+	case substrait::Type::KindCase::kFp64:
+		return type.id() == LogicalTypeId::DOUBLE;
+	case substrait::Type::KindCase::kString:
+	case substrait::Type::KindCase::kVarchar:
+	case substrait::Type::KindCase::kFixedChar:
+		return type.id() == LogicalTypeId::VARCHAR;
+	case substrait::Type::KindCase::kBinary:
+	case substrait::Type::KindCase::kFixedBinary:
+		return type.id() == LogicalTypeId::BLOB;
+	case substrait::Type::KindCase::kDate:
+		return type.id() == LogicalTypeId::DATE;
+	case substrait::Type::KindCase::kTime:
+		return type.id() == LogicalTypeId::TIME;
+	case substrait::Type::KindCase::kTimestamp:
+		return type.id() == LogicalTypeId::TIMESTAMP;
+	case substrait::Type::KindCase::kTimestampTz:
+		return type.id() == LogicalTypeId::TIMESTAMP_TZ;
+	case substrait::Type::KindCase::kIntervalYear:
+	case substrait::Type::KindCase::kIntervalDay:
+		return type.id() == LogicalTypeId::INTERVAL;
+	case substrait::Type::KindCase::kUuid:
+		return type.id() == LogicalTypeId::UUID;
+	case substrait::Type::KindCase::kDecimal:
+		return type.id() == LogicalTypeId::DECIMAL && DecimalType::GetWidth(type) == stype.decimal().precision() &&
+		       DecimalType::GetScale(type) == stype.decimal().scale();
+	case substrait::Type::KindCase::kList:
+		return type.id() == LogicalTypeId::LIST && IsSubstraitType(ListType::GetChildType(type), stype.list().type());
+	case substrait::Type::KindCase::kStruct: {
+		auto &fields = stype.struct_().types();
+		if (type.id() != LogicalTypeId::STRUCT ||
+		    StructType::GetChildCount(type) != static_cast<idx_t>(fields.size())) {
+			return false;
+		}
+		for (idx_t i = 0; i < StructType::GetChildCount(type); i++) {
+			if (!IsSubstraitType(StructType::GetChildType(type, i), fields[static_cast<int>(i)])) {
+				return false;
 			}
 		}
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+void SubstraitToDuckDB::VerifyIntermediateTypes(const substrait::AggregateRel &saggr,
+                                                const vector<LogicalType> &types) {
+	// Partial results are handed to the next phase, possibly in another process, in the types the plan declares
+	auto column = SubstraitGroupingExpressions(saggr).expressions.size();
+	for (int i = 0; i < saggr.measures_size(); i++, column++) {
+		auto &measure = saggr.measures(i).measure();
+		if (!HasIntermediateResult(measure.phase()) || !measure.has_output_type()) {
+			continue;
+		}
+		D_ASSERT(column < types.size());
+		if (!IsSubstraitType(types[column], measure.output_type())) {
+			throw InvalidInputException("Measure %d of an aggregate computes its partial results as %s, which is not "
+			                            "the type the plan declares for them",
+			                            i, types[column].ToString());
+		}
+	}
+}
+
+void SubstraitToDuckDB::TransformAggregateExpressions(const substrait::AggregateRel &saggr, GroupByNode &groups,
+                                                     vector<unique_ptr<ParsedExpression>> &expressions) {
+	// Expressions used by several groupings are grouped by once and output once
+	SubstraitGroupingExpressions grouping_expressions(saggr);
+	for (auto &sexpr : grouping_expressions.expressions) {
+		groups.group_expressions.push_back(TransformExpr(sexpr));
+		expressions.push_back(TransformExpr(sexpr));
+	}
+	for (auto &sgrp : saggr.groupings()) {
+		GroupingSet grouping_set;
+		for (auto &sexpr : sgrp.grouping_expressions()) {
+			grouping_set.insert(grouping_expressions.GetIndex(sexpr));
+		}
+		// The grouping a row belongs to is told by the grouping expressions that are part of it, which duplicate
+		// groupings share
+		if (std::find(groups.grouping_sets.begin(), groups.grouping_sets.end(), grouping_set) !=
+		    groups.grouping_sets.end()) {
+			throw NotImplementedException("Aggregates with duplicate groupings are not supported");
+		}
+		groups.grouping_sets.push_back(std::move(grouping_set));
+	}
+	if (groups.group_expressions.empty()) {
+		groups.grouping_sets.clear();
 	}
 
-	for (auto &smeas : sop.aggregate().measures()) {
+	for (auto &smeas : saggr.measures()) {
 		vector<unique_ptr<ParsedExpression>> children;
 		auto &s_aggr_function = smeas.measure();
 		bool is_distinct = s_aggr_function.invocation() ==
@@ -501,94 +1213,618 @@ shared_ptr<Relation> SubstraitToDuckDB::TransformAggregateOp(const substrait::Re
 		for (auto &sarg : s_aggr_function.arguments()) {
 			children.push_back(TransformExpr(sarg.value()));
 		}
-		auto function_name = FindFunction(s_aggr_function.function_reference());
-		if (function_name == "count" && children.empty()) {
+		auto &function = FindFunction(s_aggr_function.function_reference());
+		auto function_name = function.duckdb_name;
+		if (function.name == "count" && children.empty()) {
 			function_name = "count_star";
 		}
-		expressions.push_back(make_uniq<FunctionExpression>(RemapFunctionName(function_name), std::move(children),
-		                                                    nullptr, nullptr, is_distinct));
-	}
-
-	return make_shared_ptr<AggregateRelation>(TransformOp(sop.aggregate().input()), std::move(expressions),
-	                                          std::move(groups));
-}
-
-shared_ptr<Relation> SubstraitToDuckDB::TransformReadOp(const substrait::Rel &sop) {
-	auto &sget = sop.read();
-	shared_ptr<Relation> scan;
-	if (sget.has_named_table()) {
-		// If we can't find a table with that name, let's try a view.
-		try {
-			scan = con.Table(sget.named_table().names(0));
-		} catch (...) {
-			scan = con.View(sget.named_table().names(0));
+		// Filters and sorts are evaluated by the aggregate itself, in the same pass over the input
+		unique_ptr<ParsedExpression> filter;
+		if (smeas.has_filter()) {
+			filter = TransformExpr(smeas.filter());
 		}
-	} else if (sget.has_local_files()) {
-		vector<Value> parquet_files;
-		auto local_file_items = sget.local_files().items();
-		for (auto &current_file : local_file_items) {
-			if (current_file.has_parquet()) {
-				if (current_file.has_uri_file()) {
-					parquet_files.emplace_back(current_file.uri_file());
-				} else if (current_file.has_uri_path()) {
-					parquet_files.emplace_back(current_file.uri_path());
-				} else {
-					throw NotImplementedException("Unsupported type for file path, Only uri_file and uri_path are "
-					                              "currently supported");
-				}
-			} else {
-				throw NotImplementedException("Unsupported type of local file for read operator on substrait");
+		unique_ptr<OrderModifier> order_bys;
+		if (s_aggr_function.sorts_size() > 0) {
+			order_bys = make_uniq<OrderModifier>();
+			for (auto &sordf : s_aggr_function.sorts()) {
+				order_bys->orders.push_back(TransformOrder(sordf));
 			}
 		}
-		string name = "parquet_" + StringUtil::GenerateRandomName();
-		named_parameter_map_t named_parameters({{"binary_as_string", Value::BOOLEAN(false)}});
-		scan = con.TableFunction("parquet_scan", {Value::LIST(parquet_files)}, named_parameters)->Alias(name);
-	} else if (sget.has_virtual_table()) {
-		// We need to handle a virtual table as a LogicalExpressionGet
-		auto literal_values = sget.virtual_table().values();
-		vector<vector<Value>> expression_rows;
-		for (auto &row : literal_values) {
-			auto values = row.fields();
-			vector<Value> expression_row;
-			for (const auto &value : values) {
-				expression_row.emplace_back(TransformLiteralToValue(value));
+		auto phase = s_aggr_function.phase();
+		if (phase != substrait::AGGREGATION_PHASE_UNSPECIFIED &&
+		    phase != substrait::AGGREGATION_PHASE_INITIAL_TO_RESULT) {
+			if (is_distinct || order_bys) {
+				throw NotImplementedException("DISTINCT and ordered aggregates can't be computed in phases");
 			}
-			expression_rows.emplace_back(expression_row);
+			expressions.push_back(TransformAggregatePhase(function_name, phase, std::move(children), filter));
+			continue;
 		}
-		scan = con.Values(expression_rows);
-	} else {
-		throw NotImplementedException("Unsupported type of read operator for substrait");
+		expressions.push_back(make_uniq<FunctionExpression>(function_name, std::move(children), std::move(filter),
+		                                                    std::move(order_bys), is_distinct));
 	}
 
-	if (sget.has_filter()) {
-		scan = make_shared_ptr<FilterRelation>(std::move(scan), TransformExpr(sget.filter()));
+	if (saggr.groupings_size() <= 1) {
+		return;
 	}
-
-	if (sget.has_projection()) {
-		vector<unique_ptr<ParsedExpression>> expressions;
-		vector<string> aliases;
-		idx_t expr_idx = 0;
-		for (auto &sproj : sget.projection().select().struct_items()) {
-			// FIXME how to get actually alias?
-			aliases.push_back("expr_" + to_string(expr_idx++));
-			// TODO make sure nothing else is in there
-			expressions.push_back(make_uniq<PositionalReferenceExpression>(sproj.field() + 1));
+	// With multiple groupings the last column is the index of the grouping a row belongs to, DuckDB identifies
+	// the grouping set of a row by the bitmask GROUPING() returns for all grouping expressions
+	auto expression_count = groups.group_expressions.size();
+	if (expression_count >= 64) {
+		throw NotImplementedException("Aggregates with multiple groupings support at most 63 grouping expressions");
+	}
+	auto grouping_index = make_uniq<CaseExpression>();
+	for (idx_t i = 0; i < groups.grouping_sets.size(); i++) {
+		auto grouping = make_uniq<OperatorExpression>(ExpressionType::GROUPING_FUNCTION);
+		for (auto &group : groups.group_expressions) {
+			grouping->children.push_back(group->Copy());
 		}
-		scan = make_shared_ptr<ProjectionRelation>(std::move(scan), std::move(expressions), std::move(aliases));
+		auto mask = GetGroupingMask(groups.grouping_sets[i], expression_count);
+		CaseCheck check;
+		check.when_expr = make_uniq<ComparisonExpression>(ExpressionType::COMPARE_EQUAL, std::move(grouping),
+		                                                  make_uniq<ConstantExpression>(Value::BIGINT(mask)));
+		check.then_expr = make_uniq<ConstantExpression>(Value::INTEGER(static_cast<int32_t>(i)));
+		grouping_index->case_checks.push_back(std::move(check));
 	}
-
-	return scan;
+	if (grouping_index->case_checks.empty()) {
+		// Without grouping expressions every grouping is the empty grouping set
+		expressions.push_back(make_uniq<ConstantExpression>(Value::INTEGER(0)));
+		return;
+	}
+	grouping_index->else_expr = make_uniq<ConstantExpression>(Value(LogicalType::INTEGER));
+	expressions.push_back(std::move(grouping_index));
 }
 
-shared_ptr<Relation> SubstraitToDuckDB::TransformSortOp(const substrait::Rel &sop) {
-	vector<OrderByNode> order_nodes;
-	for (auto &sordf : sop.sort().sorts()) {
-		order_nodes.push_back(TransformOrder(sordf));
+shared_ptr<Relation> SubstraitToDuckDB::TransformAggregateOp(const substrait::Rel &sop) {
+	GroupByNode groups;
+	vector<unique_ptr<ParsedExpression>> expressions;
+	TransformAggregateExpressions(sop.aggregate(), groups, expressions);
+	auto aggregate = make_shared_ptr<AggregateRelation>(TransformOp(sop.aggregate().input()), std::move(expressions),
+	                                                    std::move(groups));
+	vector<LogicalType> types;
+	for (auto &column : aggregate->Columns()) {
+		types.push_back(column.GetType());
 	}
-	return make_shared_ptr<OrderRelation>(TransformOp(sop.sort().input()), std::move(order_nodes));
+	VerifyIntermediateTypes(sop.aggregate(), types);
+	return std::move(aggregate);
 }
 
-static SetOperationType TransformSetOperationType(substrait::SetRel_SetOp setop) {
+//! The file a LocalFiles item reads
+static string GetLocalFilePath(const substrait::ReadRel_LocalFiles_FileOrFiles &item) {
+	if (item.has_uri_file()) {
+		return item.uri_file();
+	}
+	if (item.has_uri_path()) {
+		return item.uri_path();
+	}
+	throw NotImplementedException("Unsupported type for file path, Only uri_file and uri_path are "
+	                              "currently supported");
+}
+
+static Value TransformReadOptionValue(const string &name, const google::protobuf::Value &value) {
+	switch (value.kind_case()) {
+	case google::protobuf::Value::kNullValue:
+		return Value();
+	case google::protobuf::Value::kBoolValue:
+		return Value::BOOLEAN(value.bool_value());
+	case google::protobuf::Value::kStringValue:
+		return Value(value.string_value());
+	case google::protobuf::Value::kNumberValue: {
+		// JSON has no integers, whole numbers are given to the options that take integers as such
+		auto number = value.number_value();
+		auto limit = static_cast<double>(NumericLimits<int64_t>::Maximum());
+		if (number > -limit && number < limit && static_cast<double>(static_cast<int64_t>(number)) == number) {
+			return Value::BIGINT(static_cast<int64_t>(number));
+		}
+		return Value::DOUBLE(number);
+	}
+	case google::protobuf::Value::kListValue: {
+		vector<Value> children;
+		for (auto &child : value.list_value().values()) {
+			children.push_back(TransformReadOptionValue(name, child));
+		}
+		if (children.empty()) {
+			return Value::LIST(LogicalType::VARCHAR, std::move(children));
+		}
+		return Value::LIST(std::move(children));
+	}
+	default:
+		// The fields of a google.protobuf.Struct have no order, which the struct options of the readers depend on
+		throw NotImplementedException("The read option \"%s\" must be a boolean, number, string or list", name);
+	}
+}
+
+//! The table function that reads the files of a LocalFiles item, and the options it is called with
+//! The bundled Substrait version has no read options for delimited text and JSON, these files are read through an
+//! extension format: a google.protobuf.Struct whose string "format" is csv or json, and whose other fields are the
+//! named parameters of read_csv or read_json
+static string GetFileScanFunction(const substrait::ReadRel_LocalFiles_FileOrFiles &item,
+                                  named_parameter_map_t &options) {
+	switch (item.file_format_case()) {
+	case substrait::ReadRel_LocalFiles_FileOrFiles::kParquet:
+		options["binary_as_string"] = Value::BOOLEAN(false);
+		return "parquet_scan";
+	case substrait::ReadRel_LocalFiles_FileOrFiles::kArrow:
+		// The arrow extension of DuckDB only scans Arrow IPC buffers in memory, not files
+		throw NotImplementedException("Arrow IPC files are not supported, DuckDB has no reader for them");
+	case substrait::ReadRel_LocalFiles_FileOrFiles::kExtension: {
+		google::protobuf::Struct format;
+		if (!item.extension().Is<google::protobuf::Struct>() || !item.extension().UnpackTo(&format)) {
+			throw NotImplementedException("Unsupported extension file format %s", item.extension().type_url());
+		}
+		string function;
+		for (auto &field : format.fields()) {
+			if (field.first != "format") {
+				options[field.first] = TransformReadOptionValue(field.first, field.second);
+				continue;
+			}
+			auto &name = field.second.string_value();
+			if (name == "csv") {
+				function = "read_csv";
+			} else if (name == "json") {
+				function = "read_json";
+			} else {
+				throw NotImplementedException("Unsupported extension file format \"%s\"", name);
+			}
+		}
+		if (function.empty()) {
+			throw InvalidInputException("An extension file format needs a format, either \"csv\" or \"json\"");
+		}
+		return function;
+	}
+	default:
+		throw NotImplementedException("Unsupported type of local file for read operator on substrait");
+	}
+}
+
+//! Items with equal keys are read in one scan
+static string GetFileScanKey(const substrait::ReadRel_LocalFiles_FileOrFiles &item) {
+	auto key = to_string(static_cast<int>(item.file_format_case()));
+	if (item.has_extension()) {
+		key += item.extension().type_url() + item.extension().value();
+	}
+	return key;
+}
+
+//! Whether only the row groups that start within the byte range of an item are read, instead of its whole file
+static bool IsFileSplit(const substrait::ReadRel_LocalFiles_FileOrFiles &item) {
+	return item.length() > 0;
+}
+
+bool SubstraitToDuckDB::ReadsLocalFile(const substrait::ReadRel_LocalFiles_FileOrFiles &item) const {
+	// Like exchanges, only the files of the outermost reads are split up into partitions
+	return !partition.IsValid() || exchange_depth > 0 || item.partition_index() == partition.GetIndex();
+}
+
+bool SubstraitToDuckDB::ReadsWholeFiles(const substrait::ReadRel_LocalFiles &local_files) const {
+	for (auto &item : local_files.items()) {
+		if (!ReadsLocalFile(item) || IsFileSplit(item) ||
+		    GetFileScanKey(item) != GetFileScanKey(local_files.items(0))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static Value TransformLocalFiles(const substrait::ReadRel_LocalFiles &local_files) {
+	vector<Value> files;
+	for (auto &current_file : local_files.items()) {
+		files.emplace_back(GetLocalFilePath(current_file));
+	}
+	return Value::LIST(LogicalType::VARCHAR, std::move(files));
+}
+
+//! Virtual tables with more rows are decoded into a ColumnDataCollection, smaller ones are read as VALUES lists
+static constexpr idx_t MAX_VALUES_LIST_ROWS = STANDARD_VECTOR_SIZE;
+
+template <class T, class SRC>
+static bool TryWriteLiteral(Vector &result, idx_t row, LogicalTypeId type, SRC value) {
+	if (result.GetType().id() != type) {
+		return false;
+	}
+	FlatVector::GetData<T>(result)[row] = T(value);
+	return true;
+}
+
+//! Writes a literal to a row of a flat vector, the literals of the type of the vector are written without creating a
+//! Value first
+static void WriteLiteral(const substrait::Expression_Literal &literal, Vector &result, idx_t row) {
+	if (literal.has_null()) {
+		FlatVector::SetNull(result, row, true);
+		return;
+	}
+	switch (literal.literal_type_case()) {
+	case substrait::Expression_Literal::LiteralTypeCase::kBoolean:
+		if (TryWriteLiteral<bool>(result, row, LogicalTypeId::BOOLEAN, literal.boolean())) {
+			return;
+		}
+		break;
+	case substrait::Expression_Literal::LiteralTypeCase::kI8:
+		if (TryWriteLiteral<int8_t>(result, row, LogicalTypeId::TINYINT, literal.i8())) {
+			return;
+		}
+		break;
+	case substrait::Expression_Literal::LiteralTypeCase::kI16:
+		if (TryWriteLiteral<int16_t>(result, row, LogicalTypeId::SMALLINT, literal.i16())) {
+			return;
+		}
+		break;
+	case substrait::Expression_Literal::LiteralTypeCase::kI32:
+		if (TryWriteLiteral<int32_t>(result, row, LogicalTypeId::INTEGER, literal.i32())) {
+			return;
+		}
+		break;
+	case substrait::Expression_Literal::LiteralTypeCase::kI64:
+		if (TryWriteLiteral<int64_t>(result, row, LogicalTypeId::BIGINT, literal.i64())) {
+			return;
+		}
+		break;
+	case substrait::Expression_Literal::LiteralTypeCase::kFp32:
+		if (TryWriteLiteral<float>(result, row, LogicalTypeId::FLOAT, literal.fp32())) {
+			return;
+		}
+		break;
+	case substrait::Expression_Literal::LiteralTypeCase::kFp64:
+		if (TryWriteLiteral<double>(result, row, LogicalTypeId::DOUBLE, literal.fp64())) {
+			return;
+		}
+		break;
+	case substrait::Expression_Literal::LiteralTypeCase::kDate:
+		if (TryWriteLiteral<date_t>(result, row, LogicalTypeId::DATE, literal.date())) {
+			return;
+		}
+		break;
+	case substrait::Expression_Literal::LiteralTypeCase::kString:
+		if (result.GetType().id() == LogicalTypeId::VARCHAR) {
+			FlatVector::GetData<string_t>(result)[row] = StringVector::AddString(result, literal.string());
+			return;
+		}
+		break;
+	default:
+		break;
+	}
+	auto value = TransformLiteralToValue(literal);
+	if (value.type() != result.GetType()) {
+		value = value.DefaultCastAs(result.GetType());
+	}
+	result.SetValue(row, value);
+}
+
+unique_ptr<TableRef> SubstraitToDuckDB::TransformVirtualTable(const substrait::ReadRel &sget) {
+	auto &rows = sget.virtual_table().values();
+	auto &schema = sget.base_schema().struct_();
+	// The types of the columns are only known up front from the base schema
+	if (!virtual_table_context || static_cast<idx_t>(rows.size()) <= MAX_VALUES_LIST_ROWS ||
+	    schema.types_size() == 0) {
+		return nullptr;
+	}
+	auto &context = *virtual_table_context;
+	vector<LogicalType> types;
+	for (auto &type : schema.types()) {
+		types.push_back(SubstraitToDuckType(type));
+	}
+	for (int row = 0; row < rows.size(); row++) {
+		if (rows[row].fields_size() != schema.types_size()) {
+			throw InvalidInputException("Row %d of the virtual table has %d fields, but its base schema has %d columns",
+			                            row, rows[row].fields_size(), schema.types_size());
+		}
+	}
+	// The collection is managed by the buffer manager, so it counts towards the memory limit and can be spilled
+	auto collection = make_shared_ptr<ColumnDataCollection>(BufferManager::GetBufferManager(context), types);
+	DataChunk chunk;
+	chunk.Initialize(Allocator::Get(context), types);
+	for (idx_t offset = 0; offset < static_cast<idx_t>(rows.size()); offset += STANDARD_VECTOR_SIZE) {
+		auto count = MinValue<idx_t>(STANDARD_VECTOR_SIZE, static_cast<idx_t>(rows.size()) - offset);
+		for (idx_t col = 0; col < types.size(); col++) {
+			auto &column = chunk.data[col];
+			for (idx_t row = 0; row < count; row++) {
+				auto &literal = rows[static_cast<int>(offset + row)].fields(static_cast<int>(col));
+				WriteLiteral(literal, column, row);
+			}
+		}
+		chunk.SetCardinality(count);
+		collection->Append(chunk);
+		chunk.Reset();
+	}
+	// The plan scans the collection by its id, so copies of the plan share it and the plan can be inlined into the
+	// query of the caller, which binds the scan while the collection is kept alive through GetVirtualTables
+	auto id = SubstraitVirtualTables::Get(context)->Insert(collection);
+	virtual_tables.push_back(std::move(collection));
+	vector<unique_ptr<ParsedExpression>> children;
+	children.push_back(make_uniq<ConstantExpression>(Value::UBIGINT(id)));
+	auto result = make_uniq<TableFunctionRef>();
+	result->function = make_uniq<FunctionExpression>("substrait_virtual_table", std::move(children));
+	result->alias = "values";
+	return std::move(result);
+}
+
+//! A column of a base schema, with the fields of its structs
+struct SubstraitSchemaField {
+	string name;
+	vector<SubstraitSchemaField> children;
+};
+
+static SubstraitSchemaField ReadSchemaField(const substrait::Type &type, const substrait::NamedStruct &schema,
+                                            int &name_idx);
+
+//! Reads the fields of the structs a type nests, the structs within lists and maps name their fields too, but their
+//! fields can't be selected and are only skipped
+static void ReadNestedFields(const substrait::Type &type, const substrait::NamedStruct &schema, int &name_idx,
+                             vector<SubstraitSchemaField> &fields) {
+	switch (type.kind_case()) {
+	case substrait::Type::kStruct:
+		for (auto &child : type.struct_().types()) {
+			fields.push_back(ReadSchemaField(child, schema, name_idx));
+		}
+		break;
+	case substrait::Type::kList: {
+		vector<SubstraitSchemaField> element_fields;
+		ReadNestedFields(type.list().type(), schema, name_idx, element_fields);
+		break;
+	}
+	case substrait::Type::kMap: {
+		vector<SubstraitSchemaField> entry_fields;
+		ReadNestedFields(type.map().key(), schema, name_idx, entry_fields);
+		ReadNestedFields(type.map().value(), schema, name_idx, entry_fields);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+//! The names of a base schema list the fields of its structs depth first, after the column they belong to
+static SubstraitSchemaField ReadSchemaField(const substrait::Type &type, const substrait::NamedStruct &schema,
+                                            int &name_idx) {
+	if (name_idx >= schema.names_size()) {
+		throw InvalidInputException("The base schema of the read has fewer names than fields");
+	}
+	SubstraitSchemaField field;
+	field.name = schema.names(name_idx++);
+	ReadNestedFields(type, schema, name_idx, field.children);
+	return field;
+}
+
+static unique_ptr<ParsedExpression>
+TransformStructSelect(unique_ptr<ParsedExpression> input, const vector<SubstraitSchemaField> &fields,
+                      const substrait::Expression_MaskExpression_StructSelect &select);
+
+//! Transform a selected column or struct field, which is narrowed down to the fields selected from it
+static unique_ptr<ParsedExpression> TransformStructItem(unique_ptr<ParsedExpression> input,
+                                                        const SubstraitSchemaField &field,
+                                                        const substrait::Expression_MaskExpression_StructItem &item) {
+	if (!item.has_child()) {
+		return input;
+	}
+	if (!item.child().has_struct_()) {
+		throw NotImplementedException("Only the fields of structs can be selected from the columns of a read");
+	}
+	return TransformStructSelect(std::move(input), field.children, item.child().struct_());
+}
+
+//! A struct of the selected fields of a struct, which is NULL where the struct is
+static unique_ptr<ParsedExpression>
+TransformStructSelect(unique_ptr<ParsedExpression> input, const vector<SubstraitSchemaField> &fields,
+                      const substrait::Expression_MaskExpression_StructSelect &select) {
+	vector<unique_ptr<ParsedExpression>> children;
+	for (auto &item : select.struct_items()) {
+		if (item.field() < 0 || static_cast<idx_t>(item.field()) >= fields.size()) {
+			throw InvalidInputException("The read selects field %d of a struct with %llu fields", item.field(),
+			                            fields.size());
+		}
+		auto &field = fields[static_cast<idx_t>(item.field())];
+		vector<unique_ptr<ParsedExpression>> extract_children;
+		extract_children.push_back(input->Copy());
+		extract_children.push_back(make_uniq<ConstantExpression>(Value(field.name)));
+		auto child = TransformStructItem(make_uniq<FunctionExpression>("struct_extract", std::move(extract_children)),
+		                                 field, item);
+		child->alias = field.name;
+		children.push_back(std::move(child));
+	}
+	auto result = make_uniq<CaseExpression>();
+	CaseCheck check;
+	check.when_expr = make_uniq<OperatorExpression>(ExpressionType::OPERATOR_IS_NULL, std::move(input));
+	check.then_expr = make_uniq<ConstantExpression>(Value());
+	result->case_checks.push_back(std::move(check));
+	result->else_expr = make_uniq<FunctionExpression>("struct_pack", std::move(children));
+	return std::move(result);
+}
+
+//! The columns a read selects, with only the selected fields of their structs, which leaves the nested fields that
+//! are not selected to be pruned from the scan together with the columns that are not
+static vector<unique_ptr<ParsedExpression>> TransformReadProjection(const substrait::ReadRel &sget) {
+	auto &select = sget.projection().select();
+	vector<SubstraitSchemaField> columns;
+	for (auto &item : select.struct_items()) {
+		if (item.has_child()) {
+			auto &schema = sget.base_schema();
+			int name_idx = 0;
+			for (auto &type : schema.struct_().types()) {
+				columns.push_back(ReadSchemaField(type, schema, name_idx));
+			}
+			break;
+		}
+	}
+	vector<unique_ptr<ParsedExpression>> expressions;
+	for (auto &item : select.struct_items()) {
+		unique_ptr<ParsedExpression> expression = make_uniq<PositionalReferenceExpression>(item.field() + 1);
+		if (item.has_child()) {
+			if (item.field() < 0 || static_cast<idx_t>(item.field()) >= columns.size()) {
+				throw InvalidInputException("The read selects column %d of a base schema with %llu columns",
+				                            item.field(), columns.size());
+			}
+			expression = TransformStructItem(std::move(expression), columns[static_cast<idx_t>(item.field())], item);
+		}
+		expression->alias = "expr_" + to_string(expressions.size());
+		expressions.push_back(std::move(expression));
+	}
+	return expressions;
+}
+
+//! Selects all columns of the given table, the query node of most Relations
+static unique_ptr<SelectNode> SelectStar(unique_ptr<TableRef> from_table) {
+	auto result = make_uniq<SelectNode>();
+	result->select_list.push_back(make_uniq<StarExpression>());
+	result->from_table = std::move(from_table);
+	return result;
+}
+
+//! The names of a named table go from its catalog down to its own name, the catalog and schema may be left out
+static QualifiedName GetQualifiedName(const substrait::ReadRel_NamedTable &named_table) {
+	auto &names = named_table.names();
+	switch (names.size()) {
+	case 1:
+		return {INVALID_CATALOG, INVALID_SCHEMA, names[0]};
+	case 2:
+		return {INVALID_CATALOG, names[0], names[1]};
+	case 3:
+		return {names[0], names[1], names[2]};
+	default:
+		throw InvalidInputException("A named table must have one to three names, its catalog, schema and name, "
+		                            "but it has %d",
+		                            names.size());
+	}
+}
+
+static string QualifiedNameToString(const QualifiedName &name) {
+	string result;
+	if (!name.catalog.empty()) {
+		result += name.catalog + ".";
+	}
+	if (!name.schema.empty()) {
+		result += name.schema + ".";
+	}
+	return result + name.name;
+}
+
+static unique_ptr<TableRef> TransformNamedTable(const QualifiedName &name) {
+	auto table = make_uniq<BaseTableRef>();
+	table->catalog_name = name.catalog;
+	table->schema_name = name.schema;
+	table->table_name = name.name;
+	return std::move(table);
+}
+
+const SubstraitNamedTable &SubstraitToDuckDB::ResolveNamedTable(const QualifiedName &name) {
+	auto key = QualifiedNameToString(name);
+	auto entry = named_tables.find(key);
+	if (entry != named_tables.end()) {
+		return entry->second;
+	}
+	// A single lookup finds tables and views alike, without throwing for the one the name doesn't refer to
+	auto &context = *con->context;
+	bool found = false;
+	SubstraitNamedTable result;
+	context.RunFunctionInTransaction([&]() {
+		auto catalog_entry = Catalog::GetEntry(context, CatalogType::TABLE_ENTRY, name.catalog, name.schema,
+		                                       name.name, OnEntryNotFound::RETURN_NULL);
+		if (!catalog_entry) {
+			return;
+		}
+		found = true;
+		result.resolved = {catalog_entry->ParentCatalog().GetName(), catalog_entry->ParentSchema().name,
+		                   catalog_entry->name};
+		result.oid = catalog_entry->oid;
+		if (catalog_entry->type != CatalogType::TABLE_ENTRY) {
+			return;
+		}
+		auto &table = catalog_entry->Cast<TableCatalogEntry>();
+		result.description = make_uniq<TableDescription>();
+		result.description->schema = table.ParentSchema().name;
+		result.description->table = table.name;
+		for (auto &column : table.GetColumns().Logical()) {
+			result.description->columns.push_back(column.Copy());
+		}
+	});
+	if (!found) {
+		throw CatalogException("Table or view with name %s does not exist", key);
+	}
+	return named_tables.emplace(std::move(key), std::move(result)).first->second;
+}
+
+shared_ptr<Relation> SubstraitToDuckDB::TransformReadOp(const substrait::Rel &sop) {
+	auto &sget = sop.read();
+	shared_ptr<Relation> scan;
+	if (sget.has_named_table()) {
+		auto name = GetQualifiedName(sget.named_table());
+		auto &named_table = ResolveNamedTable(name);
+		auto &resolved = named_table.resolved;
+		table_references.push_back({resolved, named_table.oid});
+		if (named_table.description && resolved.catalog == DatabaseManager::GetDefaultDatabase(*con->context)) {
+			auto description = make_uniq<TableDescription>();
+			description->schema = named_table.description->schema;
+			description->table = named_table.description->table;
+			for (auto &column : named_table.description->columns) {
+				description->columns.push_back(column.Copy());
+			}
+			scan = make_shared_ptr<TableRelation>(con->context, std::move(description));
+		} else {
+			// Views, and tables of other catalogs than the default one, are read by the name they were resolved to, so
+			// the plan reads the same entry in whichever client it is bound
+			auto statement = make_uniq<SelectStatement>();
+			statement->node = SelectStar(TransformNamedTable(resolved));
+			scan = make_shared_ptr<QueryRelation>(con->context, std::move(statement), resolved.name);
+		}
+	} else if (sget.has_local_files()) {
+		string name = "parquet_" + StringUtil::GenerateRandomName();
+		auto &local_files = sget.local_files();
+		if (local_files.items_size() > 0 && ReadsWholeFiles(local_files)) {
+			named_parameter_map_t named_parameters;
+			auto function = GetFileScanFunction(local_files.items(0), named_parameters);
+			scan = con->TableFunction(function, {TransformLocalFiles(local_files)}, named_parameters)->Alias(name);
+		} else {
+			// Reading parts of the files, or files of several formats, takes a union of scans, which Relations can
+			// only express as a query
+			auto files = make_uniq<SelectStatement>();
+			files->node = TransformLocalFilesNode(sget);
+			scan = make_shared_ptr<QueryRelation>(con->context, std::move(files), name);
+		}
+	} else if (sget.has_virtual_table()) {
+		auto virtual_table = TransformVirtualTable(sget);
+		if (virtual_table) {
+			auto statement = make_uniq<SelectStatement>();
+			statement->node = SelectStar(std::move(virtual_table));
+			scan = make_shared_ptr<QueryRelation>(con->context, std::move(statement), "values");
+		} else {
+			// We need to handle a virtual table as a LogicalExpressionGet
+			vector<vector<Value>> expression_rows;
+			for (auto &row : sget.virtual_table().values()) {
+				vector<Value> expression_row;
+				for (const auto &value : row.fields()) {
+					expression_row.emplace_back(TransformLiteralToValue(value));
+				}
+				expression_rows.push_back(std::move(expression_row));
+			}
+			scan = con->Values(expression_rows);
+		}
+	} else {
+		throw NotImplementedException("Unsupported type of read operator for substrait");
+	}
+
+	if (sget.has_filter()) {
+		scan = make_shared_ptr<FilterRelation>(std::move(scan), TransformExpr(sget.filter()));
+	}
+
+	if (sget.has_projection()) {
+		auto expressions = TransformReadProjection(sget);
+		vector<string> aliases;
+		for (auto &expression : expressions) {
+			aliases.push_back(expression->alias);
+		}
+		scan = make_shared_ptr<ProjectionRelation>(std::move(scan), std::move(expressions), std::move(aliases));
+	}
+
+	return scan;
+}
+
+shared_ptr<Relation> SubstraitToDuckDB::TransformSortOp(const substrait::Rel &sop) {
+	vector<OrderByNode> order_nodes;
+	for (auto &sordf : sop.sort().sorts()) {
+		order_nodes.push_back(TransformOrder(sordf));
+	}
+	return make_shared_ptr<OrderRelation>(TransformOp(sop.sort().input()), std::move(order_nodes));
+}
+
+static SetOperationType TransformSetOperationType(substrait::SetRel_SetOp setop) {
 	switch (setop) {
 	case substrait::SetRel_SetOp::SetRel_SetOp_SET_OP_UNION_ALL: {
 		return SetOperationType::UNION;
@@ -613,6 +1849,9 @@ shared_ptr<Relation> SubstraitToDuckDB::TransformSetOp(const substrait::Rel &sop
 
 	auto &inputs = set.inputs();
 	auto input_count = set.inputs_size();
+	if (input_count < 2) {
+		throw InvalidInputException("A set operation needs at least two inputs, but it has %d", input_count);
+	}
 	if (input_count > 2) {
 		throw NotImplementedException("The amount of inputs (%d) is not supported for this set operation", input_count);
 	}
@@ -622,6 +1861,139 @@ shared_ptr<Relation> SubstraitToDuckDB::TransformSetOp(const substrait::Rel &sop
 	return make_shared_ptr<SetOpRelation>(std::move(lhs), std::move(rhs), type);
 }
 
+//! value % count, the partition a hash maps to
+static unique_ptr<ParsedExpression> PartitionOf(unique_ptr<ParsedExpression> value, const Value &count) {
+	vector<unique_ptr<ParsedExpression>> children;
+	children.push_back(std::move(value));
+	children.push_back(make_uniq<ConstantExpression>(count));
+	return make_uniq<FunctionExpression>("%", std::move(children), nullptr, nullptr, false, true);
+}
+
+unique_ptr<ParsedExpression> SubstraitToDuckDB::TransformPartitionCondition(const substrait::ExchangeRel &sexchange,
+                                                                          idx_t column_count) {
+	auto selected = partition.GetIndex();
+	auto get_partition_count = [&]() -> idx_t {
+		if (sexchange.partition_count() <= 0) {
+			throw InvalidInputException("An exchange needs a positive partition count to scatter its rows");
+		}
+		auto partition_count = static_cast<idx_t>(sexchange.partition_count());
+		if (selected >= partition_count) {
+			throw InvalidInputException("Partition %llu is out of range, the exchange has %llu partitions", selected,
+			                            partition_count);
+		}
+		return partition_count;
+	};
+	unique_ptr<ParsedExpression> target;
+	switch (sexchange.exchange_kind_case()) {
+	case substrait::ExchangeRel::kScatterByFields: {
+		vector<unique_ptr<ParsedExpression>> fields;
+		for (auto &sfield : sexchange.scatter_by_fields().fields()) {
+			fields.push_back(make_uniq<PositionalReferenceExpression>(GetFieldIndex(sfield) + 1));
+		}
+		if (fields.empty()) {
+			throw InvalidInputException("An exchange needs at least one field to scatter its rows by");
+		}
+		auto hash = make_uniq<FunctionExpression>("hash", std::move(fields));
+		target = PartitionOf(std::move(hash), Value::UBIGINT(get_partition_count()));
+		break;
+	}
+	case substrait::ExchangeRel::kSingleTarget:
+		target = TransformExpr(sexchange.single_target().expression());
+		break;
+	case substrait::ExchangeRel::kMultiTarget: {
+		vector<unique_ptr<ParsedExpression>> children;
+		children.push_back(TransformExpr(sexchange.multi_target().expression()));
+		children.push_back(make_uniq<ConstantExpression>(Value::UBIGINT(selected)));
+		return make_uniq<FunctionExpression>("list_contains", std::move(children));
+	}
+	case substrait::ExchangeRel::kRoundRobin: {
+		// Dealing rows out in turn depends on the order they arrive in, which differs between the fragments of a
+		// distributed plan. They are scattered by all their columns instead, so every fragment sends every row to the
+		// same single partition whatever its input order, rows equal in every column go to the same partition and the
+		// partitions are only as balanced as the hash spreads the rows
+		vector<unique_ptr<ParsedExpression>> columns;
+		for (idx_t i = 0; i < column_count; i++) {
+			columns.push_back(make_uniq<PositionalReferenceExpression>(i + 1));
+		}
+		auto hash = make_uniq<FunctionExpression>("hash", std::move(columns));
+		target = PartitionOf(std::move(hash), Value::UBIGINT(get_partition_count()));
+		break;
+	}
+	case substrait::ExchangeRel::kBroadcast:
+		return nullptr;
+	default:
+		throw NotImplementedException("Unsupported exchange kind " + to_string(sexchange.exchange_kind_case()));
+	}
+	return make_uniq<ComparisonExpression>(ExpressionType::COMPARE_EQUAL, std::move(target),
+	                                       make_uniq<ConstantExpression>(Value::UBIGINT(selected)));
+}
+
+shared_ptr<Relation> SubstraitToDuckDB::TransformExchangeOp(const substrait::Rel &sop) {
+	auto &sexchange = sop.exchange();
+	// Within DuckDB an exchange passes its input on, it only matters when a single partition is emitted
+	auto selects_partition = partition.IsValid() && exchange_depth == 0;
+	exchange_depth++;
+	auto child = TransformOp(sexchange.input());
+	exchange_depth--;
+	if (!selects_partition) {
+		return child;
+	}
+	auto column_count = sexchange.has_round_robin() ? GetColumnCount(sexchange.input()) : 0;
+	auto condition = TransformPartitionCondition(sexchange, column_count);
+	if (!condition) {
+		return child;
+	}
+	return make_shared_ptr<FilterRelation>(std::move(child), std::move(condition));
+}
+
+shared_ptr<Relation> SubstraitToDuckDB::TransformWindowOp(const substrait::Rel &sop) {
+	auto &swindow = sop.window();
+	// The results of the window functions are appended to the columns of the input
+	vector<unique_ptr<ParsedExpression>> expressions;
+	expressions.push_back(make_uniq<StarExpression>());
+	for (auto &sfunc : swindow.window_functions()) {
+		auto expression = TransformWindowFunction(sfunc, swindow.partition_expressions(), swindow.sorts());
+		expression->alias = "window_" + to_string(expressions.size() - 1);
+		expressions.push_back(std::move(expression));
+	}
+	return make_shared_ptr<ProjectionRelation>(TransformOp(swindow.input()), std::move(expressions), vector<string>());
+}
+
+const substrait::Rel &SubstraitToDuckDB::GetSubtree(const substrait::ReferenceRel &sref) {
+	auto ordinal = sref.subtree_ordinal();
+	if (ordinal < 0 || ordinal >= plan.relations_size() || !plan.relations(ordinal).has_rel()) {
+		throw InvalidInputException("ReferenceRel refers to relation %d, which is not a subtree of the plan", ordinal);
+	}
+	return plan.relations(ordinal).rel();
+}
+
+bool SubstraitToDuckDB::HasSubtrees() const {
+	for (auto &srel : plan.relations()) {
+		if (srel.has_rel()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+shared_ptr<Relation> SubstraitToDuckDB::TransformReferenceOp(const substrait::Rel &sop) {
+	// Relations can't share a subtree, the inputs that read them are transformed by TransformSharedOp instead
+	throw NotImplementedException("Subtree %d of the plan is read by a delete, which can't read shared subtrees",
+	                              sop.reference().subtree_ordinal());
+}
+
+shared_ptr<Relation> SubstraitToDuckDB::TransformSharedOp(const substrait::Rel &sop) {
+	if (!HasSubtrees()) {
+		return TransformOp(sop);
+	}
+	// Every subtree is computed once however often it is read, the query is bound in the connection right away
+	auto node = TransformNode(sop);
+	AddSharedSubtrees(*node);
+	auto statement = make_uniq<SelectStatement>();
+	statement->node = std::move(node);
+	return make_shared_ptr<QueryRelation>(con->context, std::move(statement), "shared");
+}
+
 shared_ptr<Relation> SubstraitToDuckDB::TransformWriteOp(const substrait::Rel &sop) {
 	auto &swrite = sop.write();
 	auto &nobj = swrite.named_table();
@@ -635,7 +2007,10 @@ shared_ptr<Relation> SubstraitToDuckDB::TransformWriteOp(const substrait::Rel &s
 		schema_name = nobj.names(0);
 	}
 
-	auto input = TransformOp(swrite.input());
+	// Deletes take the condition of the filter they read from, which reads the table itself
+	auto input = swrite.op() == substrait::WriteRel::WriteOp::WriteRel_WriteOp_WRITE_OP_DELETE
+	                 ? TransformOp(swrite.input())
+	                 : TransformSharedOp(swrite.input());
 	switch (swrite.op()) {
 	case substrait::WriteRel::WriteOp::WriteRel_WriteOp_WRITE_OP_CTAS:
 		return input->CreateRel(schema_name, table_name);
@@ -643,7 +2018,6 @@ shared_ptr<Relation> SubstraitToDuckDB::TransformWriteOp(const substrait::Rel &s
 		return input->InsertRel(schema_name, table_name);
 	case substrait::WriteRel::WriteOp::WriteRel_WriteOp_WRITE_OP_DELETE: {
 		auto filter = std::move(input.get()->Cast<FilterRelation>());
-		auto context = filter.child->Cast<TableRelation>().context;
 		return make_shared_ptr<DeleteRelation>(filter.context, std::move(filter.condition), schema_name, table_name);
 	}
 	default:
@@ -673,18 +2047,40 @@ shared_ptr<Relation> SubstraitToDuckDB::TransformOp(const substrait::Rel &sop) {
 		return TransformSetOp(sop);
 	case substrait::Rel::RelTypeCase::kWrite:
 		return TransformWriteOp(sop);
+	case substrait::Rel::RelTypeCase::kHashJoin:
+	case substrait::Rel::RelTypeCase::kMergeJoin:
+	case substrait::Rel::RelTypeCase::kNestedLoopJoin:
+		return TransformPhysicalJoinOp(sop);
+	case substrait::Rel::RelTypeCase::kExchange:
+		return TransformExchangeOp(sop);
+	case substrait::Rel::RelTypeCase::kWindow:
+		return TransformWindowOp(sop);
+	case substrait::Rel::RelTypeCase::kReference:
+		return TransformReferenceOp(sop);
 	default:
 		throw InternalException("Unsupported relation type " + to_string(sop.rel_type_case()));
 	}
 }
 
 void SkipColumnNamesRecurse(int32_t &columns_to_skip, const LogicalType &type) {
-	if (type.id() == LogicalTypeId::STRUCT) {
+	switch (type.id()) {
+	case LogicalTypeId::STRUCT: {
 		idx_t struct_size = StructType::GetChildCount(type);
 		columns_to_skip += static_cast<int32_t>(struct_size);
 		for (auto &struct_type : StructType::GetChildTypes(type)) {
 			SkipColumnNamesRecurse(columns_to_skip, struct_type.second);
 		}
+		break;
+	}
+	case LogicalTypeId::LIST:
+		SkipColumnNamesRecurse(columns_to_skip, ListType::GetChildType(type));
+		break;
+	case LogicalTypeId::MAP:
+		SkipColumnNamesRecurse(columns_to_skip, MapType::KeyType(type));
+		SkipColumnNamesRecurse(columns_to_skip, MapType::ValueType(type));
+		break;
+	default:
+		break;
 	}
 }
 
@@ -714,12 +2110,20 @@ shared_ptr<Relation> SubstraitToDuckDB::TransformRootOp(const substrait::RelRoot
 	const auto &column_names = sop.names();
 	vector<unique_ptr<ParsedExpression>> expressions;
 	int id = 1;
-	auto child = TransformOp(sop.input());
-	auto first_projection_or_table = GetProjection(*child);
+	shared_ptr<Relation> child;
+	Relation *first_projection_or_table;
+	if (sop.input().rel_type_case() != substrait::Rel::RelTypeCase::kWrite && HasSubtrees()) {
+		// The names are those of the columns of the query the input is transformed into
+		child = TransformSharedOp(sop.input());
+		first_projection_or_table = child.get();
+	} else {
+		child = TransformOp(sop.input());
+		first_projection_or_table = GetProjection(*child);
+	}
 	if (first_projection_or_table) {
-		vector<ColumnDefinition> *column_definitions = &first_projection_or_table->Cast<ProjectionRelation>().columns;
+		auto &column_definitions = first_projection_or_table->Columns();
 		int32_t i = 0;
-		for (auto &column : *column_definitions) {
+		for (auto &column : column_definitions) {
 			aliases.push_back(column_names[i++]);
 			auto column_type = column.GetType();
 			i += SkipColumnNames(column.GetType());
@@ -748,12 +2152,699 @@ shared_ptr<Relation> SubstraitToDuckDB::TransformRootOp(const substrait::RelRoot
 	return make_shared_ptr<ProjectionRelation>(child, std::move(expressions), aliases);
 }
 
-shared_ptr<Relation> SubstraitToDuckDB::TransformPlan() {
-	if (plan.relations().empty()) {
-		throw InvalidInputException("Substrait Plan does not have a SELECT statement");
+const substrait::RelRoot &SubstraitToDuckDB::GetRoot() const {
+	for (auto &srel : plan.relations()) {
+		if (srel.has_root()) {
+			return srel.root();
+		}
 	}
-	auto d_plan = TransformRootOp(plan.relations(0).root());
+	throw InvalidInputException("Substrait Plan does not have a SELECT statement");
+}
+
+bool SubstraitToDuckDB::IsWritePlan() const {
+	return GetRoot().input().rel_type_case() == substrait::Rel::RelTypeCase::kWrite;
+}
+
+shared_ptr<Relation> SubstraitToDuckDB::TransformPlan(Connection &con_p) {
+	con = &con_p;
+	auto d_plan = TransformRootOp(GetRoot());
 	return d_plan;
 }
 
+unique_ptr<TableRef> SubstraitToDuckDB::ToTableRef(unique_ptr<QueryNode> node, const string &alias) {
+	auto select = make_uniq<SelectStatement>();
+	select->node = std::move(node);
+	return make_uniq<SubqueryRef>(std::move(select), alias);
+}
+
+//! A scan of the given files with the given table function and named parameters
+static unique_ptr<TableRef> FileScan(const string &function, vector<Value> files,
+                                     const named_parameter_map_t &options) {
+	vector<unique_ptr<ParsedExpression>> children;
+	children.push_back(make_uniq<ConstantExpression>(Value::LIST(LogicalType::VARCHAR, std::move(files))));
+	for (auto &option : options) {
+		children.push_back(make_uniq<ComparisonExpression>(ExpressionType::COMPARE_EQUAL,
+		                                                   make_uniq<ColumnRefExpression>(option.first),
+		                                                   make_uniq<ConstantExpression>(option.second)));
+	}
+	auto table_function = make_uniq<TableFunctionRef>();
+	table_function->function = make_uniq<FunctionExpression>(function, std::move(children));
+	table_function->alias = "files_" + StringUtil::GenerateRandomName();
+	return std::move(table_function);
+}
+
+//! Selects the rows of the given row ranges, the Parquet reader skips the row groups outside of them
+static unique_ptr<ParsedExpression> RowRangeFilter(const vector<pair<idx_t, idx_t>> &ranges) {
+	unique_ptr<ParsedExpression> result;
+	for (auto &range : ranges) {
+		auto lower = make_uniq<ComparisonExpression>(ExpressionType::COMPARE_GREATERTHANOREQUALTO,
+		                                             make_uniq<ColumnRefExpression>("file_row_number"),
+		                                             make_uniq<ConstantExpression>(Value::BIGINT(range.first)));
+		auto upper = make_uniq<ComparisonExpression>(ExpressionType::COMPARE_LESSTHAN,
+		                                             make_uniq<ColumnRefExpression>("file_row_number"),
+		                                             make_uniq<ConstantExpression>(Value::BIGINT(range.second)));
+		auto condition =
+		    make_uniq<ConjunctionExpression>(ExpressionType::CONJUNCTION_AND, std::move(lower), std::move(upper));
+		if (result) {
+			result = make_uniq<ConjunctionExpression>(ExpressionType::CONJUNCTION_OR, std::move(result),
+			                                          std::move(condition));
+		} else {
+			result = std::move(condition);
+		}
+	}
+	if (!result) {
+		return make_uniq<ConstantExpression>(Value::BOOLEAN(false));
+	}
+	return result;
+}
+
+//! The rows and first byte of every row group of a Parquet file, row groups start at their dictionary page if
+//! they have one
+static constexpr const char *ROW_GROUP_QUERY =
+    "SELECT ANY_VALUE(row_group_num_rows), MIN(COALESCE(NULLIF(dictionary_page_offset, 0), data_page_offset)) "
+    "FROM parquet_metadata($1) GROUP BY row_group_id ORDER BY row_group_id";
+
+Connection &SubstraitToDuckDB::GetConnection() {
+	if (con) {
+		return *con;
+	}
+	if (!connection_provider) {
+		throw InvalidInputException("Reading byte ranges of files needs a connection to read their footers with");
+	}
+	return connection_provider();
+}
+
+vector<pair<idx_t, idx_t>> SubstraitToDuckDB::GetSplitRowRanges(const string &path, idx_t start, idx_t length) {
+	auto result = GetConnection().Query(ROW_GROUP_QUERY, path);
+	if (result->HasError()) {
+		result->ThrowError();
+	}
+	auto &row_groups = result->Cast<MaterializedQueryResult>();
+	// A row group belongs to the range its first byte is in, so the ranges of a file each read distinct row groups
+	vector<pair<idx_t, idx_t>> ranges;
+	idx_t row_offset = 0;
+	for (idx_t i = 0; i < row_groups.RowCount(); i++) {
+		auto row_count = row_groups.GetValue(0, i).GetValue<idx_t>();
+		auto row_group_start = row_groups.GetValue(1, i).GetValue<idx_t>();
+		if (row_group_start >= start && row_group_start - start < length) {
+			if (!ranges.empty() && ranges.back().second == row_offset) {
+				ranges.back().second += row_count;
+			} else {
+				ranges.emplace_back(row_offset, row_offset + row_count);
+			}
+		}
+		row_offset += row_count;
+	}
+	return ranges;
+}
+
+unique_ptr<SelectNode> SubstraitToDuckDB::TransformLocalFilesNode(const substrait::ReadRel &sget) {
+	auto &schema = sget.base_schema().struct_();
+	auto column_count = static_cast<idx_t>(schema.types_size());
+	// Whole files are read by one scan per format
+	vector<string> scan_keys;
+	vector<const substrait::ReadRel_LocalFiles_FileOrFiles *> scan_formats;
+	vector<vector<Value>> scan_files;
+	vector<unique_ptr<SelectNode>> scans;
+	for (auto &item : sget.local_files().items()) {
+		auto path = GetLocalFilePath(item);
+		if (!ReadsLocalFile(item)) {
+			continue;
+		}
+		if (!IsFileSplit(item)) {
+			auto key = GetFileScanKey(item);
+			idx_t scan_idx = 0;
+			while (scan_idx < scan_keys.size() && scan_keys[scan_idx] != key) {
+				scan_idx++;
+			}
+			if (scan_idx == scan_keys.size()) {
+				scan_keys.push_back(std::move(key));
+				scan_formats.push_back(&item);
+				scan_files.emplace_back();
+			}
+			scan_files[scan_idx].emplace_back(path);
+			continue;
+		}
+		if (!item.has_parquet()) {
+			throw NotImplementedException("Only Parquet files can be read in byte ranges");
+		}
+		if (column_count == 0) {
+			throw InvalidInputException("Reading a byte range of a file needs the base schema of the file");
+		}
+		// file_row_number follows the columns of the file, which are selected by their position
+		auto split = make_uniq<SelectNode>();
+		for (idx_t i = 0; i < column_count; i++) {
+			split->select_list.push_back(make_uniq<PositionalReferenceExpression>(i + 1));
+		}
+		named_parameter_map_t options;
+		auto function = GetFileScanFunction(item, options);
+		options["file_row_number"] = Value::BOOLEAN(true);
+		split->from_table = FileScan(function, {Value(path)}, options);
+		split->where_clause = RowRangeFilter(GetSplitRowRanges(path, item.start(), item.length()));
+		scans.push_back(std::move(split));
+		reads_file_splits = true;
+	}
+	for (idx_t i = 0; i < scan_formats.size(); i++) {
+		named_parameter_map_t options;
+		auto function = GetFileScanFunction(*scan_formats[i], options);
+		scans.push_back(SelectStar(FileScan(function, std::move(scan_files[i]), options)));
+	}
+	if (scans.empty()) {
+		// No file is read, but the read still has the columns of its base schema
+		if (column_count == 0) {
+			throw InvalidInputException("Reading no file needs the base schema of the files");
+		}
+		auto empty = make_uniq<SelectNode>();
+		for (int i = 0; i < schema.types_size(); i++) {
+			auto column =
+			    make_uniq<CastExpression>(SubstraitToDuckType(schema.types(i)), make_uniq<ConstantExpression>(Value()));
+			column->alias = "col" + to_string(i);
+			empty->select_list.push_back(std::move(column));
+		}
+		empty->where_clause = make_uniq<ConstantExpression>(Value::BOOLEAN(false));
+		return empty;
+	}
+	if (scans.size() == 1) {
+		return std::move(scans[0]);
+	}
+	unique_ptr<QueryNode> files = std::move(scans[0]);
+	for (idx_t i = 1; i < scans.size(); i++) {
+		auto setop = make_uniq<SetOperationNode>();
+		setop->setop_type = SetOperationType::UNION;
+		setop->setop_all = true;
+		setop->left = std::move(files);
+		setop->right = std::move(scans[i]);
+		files = std::move(setop);
+	}
+	return SelectStar(ToTableRef(std::move(files), "files"));
+}
+
+unique_ptr<QueryNode> SubstraitToDuckDB::TransformJoinNode(const substrait::Rel &sop) {
+	auto &sjoin = sop.join();
+	auto join = make_uniq<JoinRef>(JoinRefType::REGULAR);
+	join->type = TransformJoinType(sjoin);
+	join->condition = TransformExpr(sjoin.expression());
+	join->left = ToTableRef(TransformNode(sjoin.left()), "left");
+	join->right = ToTableRef(TransformNode(sjoin.right()), "right");
+	return SelectStar(std::move(join));
+}
+
+unique_ptr<QueryNode> SubstraitToDuckDB::TransformPhysicalJoinNode(const substrait::Rel &sop) {
+	auto physical_join = TransformPhysicalJoin(sop);
+	auto join = make_uniq<JoinRef>(JoinRefType::REGULAR);
+	join->type = physical_join.type;
+	join->condition = std::move(physical_join.condition);
+	join->left = ToTableRef(TransformNode(*physical_join.left), "left");
+	join->right = ToTableRef(TransformNode(*physical_join.right), "right");
+	return SelectStar(std::move(join));
+}
+
+unique_ptr<QueryNode> SubstraitToDuckDB::TransformCrossProductNode(const substrait::Rel &sop) {
+	auto &sub_cross = sop.cross();
+	auto cross = make_uniq<JoinRef>(JoinRefType::CROSS);
+	cross->left = ToTableRef(TransformNode(sub_cross.left()), "left");
+	cross->right = ToTableRef(TransformNode(sub_cross.right()), "right");
+	return SelectStar(std::move(cross));
+}
+
+unique_ptr<QueryNode> SubstraitToDuckDB::TransformFetchNode(const substrait::Rel &sop) {
+	auto &slimit = sop.fetch();
+	auto result = TransformNode(slimit.input());
+	auto limit = make_uniq<LimitModifier>();
+	if (slimit.count() != -1) {
+		limit->limit = make_uniq<ConstantExpression>(Value::BIGINT(slimit.count()));
+	}
+	if (slimit.offset() > 0) {
+		limit->offset = make_uniq<ConstantExpression>(Value::BIGINT(slimit.offset()));
+	}
+	result->modifiers.push_back(std::move(limit));
+	return result;
+}
+
+unique_ptr<TableRef> SubstraitToDuckDB::ToScopeTableRef(unique_ptr<QueryNode> input, const substrait::Rel &sinput,
+                                                        const SubstraitOuterScope &scope, const string &alias) {
+	if (!scope.referenced) {
+		return ToTableRef(std::move(input), alias);
+	}
+	auto result = make_uniq<SelectNode>();
+	auto column_count = GetColumnCount(sinput);
+	for (idx_t i = 0; i < column_count; i++) {
+		auto column = make_uniq<PositionalReferenceExpression>(i + 1);
+		column->alias = OuterColumnName(i);
+		result->select_list.push_back(std::move(column));
+	}
+	result->from_table = ToTableRef(std::move(input), alias);
+	return ToTableRef(std::move(result), scope.alias);
+}
+
+unique_ptr<QueryNode> SubstraitToDuckDB::TransformFilterNode(const substrait::Rel &sop) {
+	auto &sfilter = sop.filter();
+	auto scope = CreateOuterScope();
+	operator_scope = &scope;
+	auto condition = TransformExpr(sfilter.condition());
+	operator_scope = nullptr;
+	auto result = SelectStar(ToScopeTableRef(TransformNode(sfilter.input()), sfilter.input(), scope, "filter"));
+	result->where_clause = std::move(condition);
+	return std::move(result);
+}
+
+unique_ptr<QueryNode> SubstraitToDuckDB::TransformProjectNode(const substrait::Rel &sop) {
+	auto scope = CreateOuterScope();
+	operator_scope = &scope;
+	auto result = make_uniq<SelectNode>();
+	for (auto &sexpr : sop.project().expressions()) {
+		auto expression = TransformExpr(sexpr);
+		expression->alias = "expr_" + to_string(result->select_list.size());
+		result->select_list.push_back(std::move(expression));
+	}
+	operator_scope = nullptr;
+	auto &sinput = sop.project().input();
+	result->from_table = ToScopeTableRef(TransformNode(sinput), sinput, scope, "projection");
+	return std::move(result);
+}
+
+unique_ptr<QueryNode> SubstraitToDuckDB::TransformAggregateNode(const substrait::Rel &sop) {
+	GroupByNode groups;
+	vector<unique_ptr<ParsedExpression>> expressions;
+	TransformAggregateExpressions(sop.aggregate(), groups, expressions);
+
+	auto result = make_uniq<SelectNode>();
+	result->select_list = std::move(expressions);
+	if (groups.group_expressions.empty()) {
+		result->aggregate_handling = AggregateHandling::FORCE_AGGREGATES;
+	} else {
+		result->groups = std::move(groups);
+	}
+	result->from_table = ToTableRef(TransformNode(sop.aggregate().input()), "aggregate");
+	VerifyIntermediateTypes(sop.aggregate(), *result);
+	return std::move(result);
+}
+
+void SubstraitToDuckDB::VerifyIntermediateTypes(const substrait::AggregateRel &saggr, const SelectNode &aggregate) {
+	if (!DeclaresIntermediateTypes(saggr) || (!con && !connection_provider)) {
+		return;
+	}
+	auto statement = make_uniq<SelectStatement>();
+	statement->node = aggregate.Copy();
+	for (auto &subtree : shared_subtrees) {
+		auto cte = make_uniq<CommonTableExpressionInfo>();
+		cte->query = make_uniq<SelectStatement>();
+		cte->query->node = subtree.second->Copy();
+		statement->node->cte_map.map[subtree.first] = std::move(cte);
+	}
+	statement->n_param = parameter_count;
+	for (idx_t i = 0; i < parameter_count; i++) {
+		statement->named_param_map[to_string(i + 1)] = i;
+	}
+	auto prepared = GetConnection().Prepare(std::move(statement));
+	if (prepared->HasError()) {
+		// Aggregates that read columns of an outer query can't be bound on their own, they and any other binding
+		// error are left to the binder of the whole query
+		return;
+	}
+	VerifyIntermediateTypes(saggr, prepared->GetTypes());
+}
+
+unique_ptr<QueryNode> SubstraitToDuckDB::TransformReadNode(const substrait::Rel &sop) {
+	auto &sget = sop.read();
+	unique_ptr<SelectNode> scan;
+	if (sget.has_named_table()) {
+		auto name = GetQualifiedName(sget.named_table());
+		if (con) {
+			// Names are resolved once in the connection Relations are bound in, like TransformReadOp resolves them
+			auto &named_table = ResolveNamedTable(name);
+			table_references.push_back({named_table.resolved, named_table.oid});
+			scan = SelectStar(TransformNamedTable(named_table.resolved));
+		} else {
+			// The binder resolves the name to either a table or a view
+			table_references.push_back({name, optional_idx()});
+			scan = SelectStar(TransformNamedTable(name));
+		}
+	} else if (sget.has_local_files()) {
+		scan = TransformLocalFilesNode(sget);
+	} else if (sget.has_virtual_table()) {
+		auto virtual_table = TransformVirtualTable(sget);
+		if (virtual_table) {
+			scan = SelectStar(std::move(virtual_table));
+		} else {
+			auto values = make_uniq<ExpressionListRef>();
+			for (auto &row : sget.virtual_table().values()) {
+				vector<unique_ptr<ParsedExpression>> expression_row;
+				for (const auto &value : row.fields()) {
+					expression_row.push_back(make_uniq<ConstantExpression>(TransformLiteralToValue(value)));
+				}
+				values->values.push_back(std::move(expression_row));
+			}
+			if (!values->values.empty()) {
+				for (idx_t i = 0; i < values->values[0].size(); i++) {
+					values->expected_names.push_back("col" + to_string(i));
+				}
+			}
+			values->alias = "values";
+			scan = SelectStar(std::move(values));
+		}
+	} else {
+		throw NotImplementedException("Unsupported type of read operator for substrait");
+	}
+
+	if (sget.has_filter()) {
+		scan = SelectStar(ToTableRef(std::move(scan), "filter"));
+		scan->where_clause = TransformExpr(sget.filter());
+	}
+
+	if (sget.has_projection()) {
+		auto projection = make_uniq<SelectNode>();
+		projection->select_list = TransformReadProjection(sget);
+		projection->from_table = ToTableRef(std::move(scan), "projection");
+		scan = std::move(projection);
+	}
+	return std::move(scan);
+}
+
+unique_ptr<QueryNode> SubstraitToDuckDB::TransformSortNode(const substrait::Rel &sop) {
+	auto order = make_uniq<OrderModifier>();
+	for (auto &sordf : sop.sort().sorts()) {
+		order->orders.push_back(TransformOrder(sordf));
+	}
+	auto result = SelectStar(ToTableRef(TransformNode(sop.sort().input()), "order"));
+	result->modifiers.push_back(std::move(order));
+	return std::move(result);
+}
+
+unique_ptr<QueryNode> SubstraitToDuckDB::TransformSetNode(const substrait::Rel &sop) {
+	D_ASSERT(sop.has_set());
+	auto &set = sop.set();
+	auto input_count = set.inputs_size();
+	if (input_count < 2) {
+		throw InvalidInputException("A set operation needs at least two inputs, but it has %d", input_count);
+	}
+	if (input_count > 2) {
+		throw NotImplementedException("The amount of inputs (%d) is not supported for this set operation", input_count);
+	}
+	auto result = make_uniq<SetOperationNode>();
+	result->setop_type = TransformSetOperationType(set.op());
+	// Same semantics as the SetOpRelation the Relation backend creates
+	result->setop_all = true;
+	result->left = TransformNode(set.inputs(0));
+	result->right = TransformNode(set.inputs(1));
+	return std::move(result);
+}
+
+//! Collects the names of the named tables the plan reads by their name alone, which CTEs of the same name shadow
+static void CollectUnqualifiedTableNames(const google::protobuf::Message &message, case_insensitive_set_t &names) {
+	auto named_table = dynamic_cast<const substrait::ReadRel_NamedTable *>(&message);
+	if (named_table && named_table->names_size() == 1) {
+		names.insert(named_table->names(0));
+		return;
+	}
+	auto reflection = message.GetReflection();
+	vector<const google::protobuf::FieldDescriptor *> fields;
+	reflection->ListFields(message, &fields);
+	for (auto field : fields) {
+		if (field->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+			continue;
+		}
+		if (!field->is_repeated()) {
+			CollectUnqualifiedTableNames(reflection->GetMessage(message, field), names);
+			continue;
+		}
+		for (int i = 0; i < reflection->FieldSize(message, field); i++) {
+			CollectUnqualifiedTableNames(reflection->GetRepeatedMessage(message, field, i), names);
+		}
+	}
+}
+
+string SubstraitToDuckDB::SubtreeName(int32_t ordinal) {
+	if (subtree_prefix.empty()) {
+		case_insensitive_set_t table_names;
+		CollectUnqualifiedTableNames(plan, table_names);
+		subtree_prefix = "subtree_";
+		bool shadows_table = true;
+		while (shadows_table) {
+			shadows_table = false;
+			for (auto &table_name : table_names) {
+				if (StringUtil::StartsWith(StringUtil::Lower(table_name), subtree_prefix)) {
+					subtree_prefix = "_" + subtree_prefix;
+					shadows_table = true;
+					break;
+				}
+			}
+		}
+	}
+	return subtree_prefix + to_string(ordinal);
+}
+
+unique_ptr<QueryNode> SubstraitToDuckDB::TransformReferenceNode(const substrait::Rel &sop) {
+	auto &subtree = GetSubtree(sop.reference());
+	auto ordinal = sop.reference().subtree_ordinal();
+	auto entry = subtree_transformed.find(ordinal);
+	if (entry == subtree_transformed.end()) {
+		// Subtrees are added once their own references are, so every CTE only reads CTEs defined before it
+		subtree_transformed[ordinal] = false;
+		auto node = TransformNode(subtree);
+		shared_subtrees.emplace_back(SubtreeName(ordinal), std::move(node));
+		subtree_transformed[ordinal] = true;
+	} else if (!entry->second) {
+		throw InvalidInputException("The subtree %d of the plan refers to itself", ordinal);
+	}
+	auto table = make_uniq<BaseTableRef>();
+	table->table_name = SubtreeName(ordinal);
+	return SelectStar(std::move(table));
+}
+
+unique_ptr<QueryNode> SubstraitToDuckDB::TransformWindowNode(const substrait::Rel &sop) {
+	auto &swindow = sop.window();
+	auto result = SelectStar(ToTableRef(TransformNode(swindow.input()), "window"));
+	for (auto &sfunc : swindow.window_functions()) {
+		auto expression = TransformWindowFunction(sfunc, swindow.partition_expressions(), swindow.sorts());
+		expression->alias = "window_" + to_string(result->select_list.size() - 1);
+		result->select_list.push_back(std::move(expression));
+	}
+	return std::move(result);
+}
+
+unique_ptr<QueryNode> SubstraitToDuckDB::TransformExchangeNode(const substrait::Rel &sop) {
+	auto &sexchange = sop.exchange();
+	auto selects_partition = partition.IsValid() && exchange_depth == 0;
+	exchange_depth++;
+	auto child = TransformNode(sexchange.input());
+	exchange_depth--;
+	if (!selects_partition) {
+		return child;
+	}
+	auto column_count = sexchange.has_round_robin() ? GetColumnCount(sexchange.input()) : 0;
+	auto condition = TransformPartitionCondition(sexchange, column_count);
+	if (!condition) {
+		return child;
+	}
+	auto result = SelectStar(ToTableRef(std::move(child), "exchange"));
+	result->where_clause = std::move(condition);
+	return std::move(result);
+}
+
+unique_ptr<QueryNode> SubstraitToDuckDB::TransformNode(const substrait::Rel &sop) {
+	switch (sop.rel_type_case()) {
+	case substrait::Rel::RelTypeCase::kJoin:
+		return TransformJoinNode(sop);
+	case substrait::Rel::RelTypeCase::kCross:
+		return TransformCrossProductNode(sop);
+	case substrait::Rel::RelTypeCase::kFetch:
+		return TransformFetchNode(sop);
+	case substrait::Rel::RelTypeCase::kFilter:
+		return TransformFilterNode(sop);
+	case substrait::Rel::RelTypeCase::kProject:
+		return TransformProjectNode(sop);
+	case substrait::Rel::RelTypeCase::kAggregate:
+		return TransformAggregateNode(sop);
+	case substrait::Rel::RelTypeCase::kRead:
+		return TransformReadNode(sop);
+	case substrait::Rel::RelTypeCase::kSort:
+		return TransformSortNode(sop);
+	case substrait::Rel::RelTypeCase::kSet:
+		return TransformSetNode(sop);
+	case substrait::Rel::RelTypeCase::kHashJoin:
+	case substrait::Rel::RelTypeCase::kMergeJoin:
+	case substrait::Rel::RelTypeCase::kNestedLoopJoin:
+		return TransformPhysicalJoinNode(sop);
+	case substrait::Rel::RelTypeCase::kExchange:
+		return TransformExchangeNode(sop);
+	case substrait::Rel::RelTypeCase::kWindow:
+		return TransformWindowNode(sop);
+	case substrait::Rel::RelTypeCase::kReference:
+		return TransformReferenceNode(sop);
+	default:
+		throw InternalException("Unsupported relation type " + to_string(sop.rel_type_case()));
+	}
+}
+
+//! The inputs whose columns a physical join returns
+enum class PhysicalJoinOutput : uint8_t { LEFT, RIGHT, BOTH };
+
+template <class T>
+static PhysicalJoinOutput GetPhysicalJoinOutput(typename T::JoinType type) {
+	switch (type) {
+	case T::JOIN_TYPE_LEFT_SEMI:
+	case T::JOIN_TYPE_LEFT_ANTI:
+		return PhysicalJoinOutput::LEFT;
+	case T::JOIN_TYPE_RIGHT_SEMI:
+	case T::JOIN_TYPE_RIGHT_ANTI:
+		return PhysicalJoinOutput::RIGHT;
+	default:
+		return PhysicalJoinOutput::BOTH;
+	}
+}
+
+idx_t SubstraitToDuckDB::GetColumnCount(const substrait::Rel &sop) {
+	auto get_join_column_count = [&](PhysicalJoinOutput output, const substrait::Rel &left,
+	                                  const substrait::Rel &right) -> idx_t {
+		switch (output) {
+		case PhysicalJoinOutput::LEFT:
+			return GetColumnCount(left);
+		case PhysicalJoinOutput::RIGHT:
+			return GetColumnCount(right);
+		default:
+			return GetColumnCount(left) + GetColumnCount(right);
+		}
+	};
+	switch (sop.rel_type_case()) {
+	case substrait::Rel::RelTypeCase::kRead: {
+		auto &sget = sop.read();
+		if (sget.has_projection()) {
+			return sget.projection().select().struct_items_size();
+		}
+		if (sget.base_schema().struct_().types_size() > 0) {
+			return sget.base_schema().struct_().types_size();
+		}
+		if (sget.has_virtual_table() && sget.virtual_table().values_size() > 0) {
+			return sget.virtual_table().values(0).fields_size();
+		}
+		throw NotImplementedException("Joins on columns of their inputs need the base schema of every read");
+	}
+	case substrait::Rel::RelTypeCase::kFilter:
+		return GetColumnCount(sop.filter().input());
+	case substrait::Rel::RelTypeCase::kFetch:
+		return GetColumnCount(sop.fetch().input());
+	case substrait::Rel::RelTypeCase::kSort:
+		return GetColumnCount(sop.sort().input());
+	case substrait::Rel::RelTypeCase::kProject:
+		return sop.project().expressions_size();
+	case substrait::Rel::RelTypeCase::kAggregate: {
+		auto &saggr = sop.aggregate();
+		idx_t column_count = SubstraitGroupingExpressions(saggr).expressions.size() + saggr.measures_size();
+		if (saggr.groupings_size() > 1) {
+			column_count++;
+		}
+		return column_count;
+	}
+	case substrait::Rel::RelTypeCase::kSet:
+		return GetColumnCount(sop.set().inputs(0));
+	case substrait::Rel::RelTypeCase::kExchange:
+		return GetColumnCount(sop.exchange().input());
+	case substrait::Rel::RelTypeCase::kWindow:
+		return GetColumnCount(sop.window().input()) + sop.window().window_functions_size();
+	case substrait::Rel::RelTypeCase::kReference:
+		return GetColumnCount(GetSubtree(sop.reference()));
+	case substrait::Rel::RelTypeCase::kCross:
+		return GetColumnCount(sop.cross().left()) + GetColumnCount(sop.cross().right());
+	case substrait::Rel::RelTypeCase::kJoin: {
+		auto &sjoin = sop.join();
+		if (sjoin.type() == substrait::JoinRel::JoinType::JoinRel_JoinType_JOIN_TYPE_SEMI ||
+		    sjoin.type() == substrait::JoinRel::JoinType::JoinRel_JoinType_JOIN_TYPE_ANTI) {
+			return GetColumnCount(sjoin.left());
+		}
+		return GetColumnCount(sjoin.left()) + GetColumnCount(sjoin.right());
+	}
+	case substrait::Rel::RelTypeCase::kHashJoin: {
+		auto &sjoin = sop.hash_join();
+		return get_join_column_count(GetPhysicalJoinOutput<substrait::HashJoinRel>(sjoin.type()), sjoin.left(),
+		                             sjoin.right());
+	}
+	case substrait::Rel::RelTypeCase::kMergeJoin: {
+		auto &sjoin = sop.merge_join();
+		return get_join_column_count(GetPhysicalJoinOutput<substrait::MergeJoinRel>(sjoin.type()), sjoin.left(),
+		                             sjoin.right());
+	}
+	case substrait::Rel::RelTypeCase::kNestedLoopJoin: {
+		auto &sjoin = sop.nested_loop_join();
+		return get_join_column_count(GetPhysicalJoinOutput<substrait::NestedLoopJoinRel>(sjoin.type()),
+		                             sjoin.left(), sjoin.right());
+	}
+	default:
+		throw NotImplementedException("Unsupported relation type " + to_string(sop.rel_type_case()));
+	}
+}
+
+//! The operator the Relation backend finds with GetProjection, returns its column count or -1 if there is none
+static int64_t GetProjectionColumnCount(const substrait::Rel &sop) {
+	switch (sop.rel_type_case()) {
+	case substrait::Rel::RelTypeCase::kProject:
+		return sop.project().expressions_size();
+	case substrait::Rel::RelTypeCase::kRead:
+		if (!sop.read().has_projection()) {
+			return -1;
+		}
+		return sop.read().projection().select().struct_items_size();
+	case substrait::Rel::RelTypeCase::kFetch:
+		return GetProjectionColumnCount(sop.fetch().input());
+	case substrait::Rel::RelTypeCase::kSort:
+		return GetProjectionColumnCount(sop.sort().input());
+	case substrait::Rel::RelTypeCase::kExchange:
+		return GetProjectionColumnCount(sop.exchange().input());
+	case substrait::Rel::RelTypeCase::kSet:
+		if (sop.set().inputs_size() < 2) {
+			return -1;
+		}
+		return GetProjectionColumnCount(sop.set().inputs(1));
+	default:
+		return -1;
+	}
+}
+
+unique_ptr<QueryNode> SubstraitToDuckDB::TransformRootNode(const substrait::RelRoot &sop) {
+	if (sop.input().rel_type_case() == substrait::Rel::RelTypeCase::kWrite) {
+		return nullptr;
+	}
+	const auto &column_names = sop.names();
+	auto column_count = GetProjectionColumnCount(sop.input());
+	if (column_count >= 0 && column_count != column_names.size()) {
+		// The names include the fields of nested types, skipping them requires the bound column types
+		return nullptr;
+	}
+	auto result = make_uniq<SelectNode>();
+	for (auto &column_name : column_names) {
+		auto expression = make_uniq<PositionalReferenceExpression>(result->select_list.size() + 1);
+		expression->alias = column_name;
+		result->select_list.push_back(std::move(expression));
+	}
+	result->from_table = ToTableRef(TransformNode(sop.input()), "root");
+	return std::move(result);
+}
+
+void SubstraitToDuckDB::AddSharedSubtrees(QueryNode &node) {
+	// Shared subtrees are materialized, so each of them is computed once however often it is read
+	for (auto &subtree : shared_subtrees) {
+		auto cte = make_uniq<CommonTableExpressionInfo>();
+		cte->query = make_uniq<SelectStatement>();
+		cte->query->node = std::move(subtree.second);
+		cte->materialized = CTEMaterialize::CTE_MATERIALIZE_ALWAYS;
+		node.cte_map.map[subtree.first] = std::move(cte);
+	}
+	shared_subtrees.clear();
+}
+
+unique_ptr<SelectStatement> SubstraitToDuckDB::TransformPlanToQuery() {
+	auto node = TransformRootNode(GetRoot());
+	if (!node) {
+		return nullptr;
+	}
+	AddSharedSubtrees(*node);
+	auto result = make_uniq<SelectStatement>();
+	result->node = std::move(node);
+	result->n_param = parameter_count;
+	for (idx_t i = 0; i < parameter_count; i++) {
+		result->named_param_map[to_string(i + 1)] = i;
+	}
+	return result;
+}
+
 } // namespace duckdb
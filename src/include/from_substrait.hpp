@@ -1,18 +1,149 @@
 #pragma once
 
+#include <functional>
 #include <string>
 #include <unordered_map>
 #include "substrait/plan.pb.h"
 #include "duckdb/main/connection.hpp"
+#include "duckdb/common/enums/join_type.hpp"
+#include "duckdb/common/optional_idx.hpp"
+#include "duckdb/common/optional_ptr.hpp"
 #include "duckdb/common/shared_ptr.hpp"
+#include "duckdb/common/types/column/column_data_collection.hpp"
+#include "duckdb/main/table_description.hpp"
+#include "duckdb/parser/qualified_name.hpp"
+#include "duckdb/parser/group_by_node.hpp"
+#include "duckdb/parser/query_node.hpp"
+#include "duckdb/parser/query_node/select_node.hpp"
+#include "duckdb/parser/statement/select_statement.hpp"
 
 namespace duckdb {
 
+//! How a Substrait scalar function is transformed, every kind but FUNCTION is a DuckDB expression of its own
+enum class SubstraitFunctionKind : uint8_t {
+	FUNCTION,
+	AND,
+	OR,
+	LT,
+	LTE,
+	GT,
+	GTE,
+	EQUAL,
+	NOT_EQUAL,
+	IS_NULL,
+	IS_NOT_NULL,
+	NOT,
+	IS_NOT_DISTINCT_FROM,
+	BETWEEN,
+	EXTRACT,
+	//! A placeholder for a value given when a prepared plan is executed
+	DYNAMIC_PARAMETER
+};
+
+//! A function declared by the extensions of a Substrait plan
+struct SubstraitFunction {
+	//! The declared name without its signature
+	string name;
+	//! The DuckDB function the name maps to
+	string duckdb_name;
+	SubstraitFunctionKind kind = SubstraitFunctionKind::FUNCTION;
+	//! Whether the plan declares a function with this anchor
+	bool declared = false;
+};
+
+//! A HashJoinRel, MergeJoinRel or NestedLoopJoinRel, with its inputs in the order DuckDB joins them
+struct SubstraitPhysicalJoin {
+	const substrait::Rel *left = nullptr;
+	const substrait::Rel *right = nullptr;
+	JoinType type = JoinType::INNER;
+	//! The join condition, over the columns of left followed by the columns of right
+	unique_ptr<ParsedExpression> condition;
+};
+
+//! The input of a filter or projection whose columns the subqueries in its expressions reference
+struct SubstraitOuterScope {
+	explicit SubstraitOuterScope(string alias_p) : alias(std::move(alias_p)) {
+	}
+	//! The alias the input is given, unique within the plan
+	string alias;
+	//! Whether a subquery references the columns of the input, which are then named by their index
+	bool referenced = false;
+};
+
+//! The table or view a named table of the plan refers to
+struct SubstraitNamedTable {
+	//! The catalog, schema and name of the entry the name was resolved to
+	QualifiedName resolved;
+	//! The oid of the entry when it was resolved
+	idx_t oid = 0;
+	//! The table as the Relation backend reads it, nullptr for views
+	unique_ptr<TableDescription> description;
+};
+
+//! A table or view a read operator of the plan refers to
+struct SubstraitTableReference {
+	//! The name of the plan, or the name it was resolved to if it was resolved while the plan was transformed
+	QualifiedName name;
+	//! The oid of the entry the name was resolved to, invalid if the name is resolved once the plan is bound
+	optional_idx oid;
+};
+
 class SubstraitToDuckDB {
 public:
-	SubstraitToDuckDB(Connection &con_p, const string &serialized, bool json = false);
-	//! Transforms Substrait Plan to DuckDB Relation
-	shared_ptr<Relation> TransformPlan();
+	explicit SubstraitToDuckDB(const string &serialized, bool json = false);
+	//! Emits only the given output partition of the outermost exchanges of the plan, as the fragment of a distributed
+	//! plan that receives it would, and reads only the files of that partition outside of exchanges, must be called
+	//! before the plan is transformed
+	void SelectPartition(idx_t partition_p) {
+		partition = partition_p;
+	}
+	//! Provides the connection query nodes use while they are transformed, to read the footers of the Parquet files
+	//! the plan reads byte ranges of and to bind the partial aggregates of the plan with. Relations use the
+	//! connection they are bound in
+	void SetConnectionProvider(std::function<Connection &()> provider) {
+		connection_provider = std::move(provider);
+	}
+	//! Lets the plan use dynamic parameters, which only plans that are prepared before they are executed can
+	void AllowDynamicParameters() {
+		dynamic_parameters_allowed = true;
+	}
+	//! Lets the plan use hash, merge and nested loop joins, DuckDB picks their strategy and build side itself
+	void AllowPhysicalJoinReplanning() {
+		physical_join_replanning_allowed = true;
+	}
+	//! Decodes the virtual tables with many rows into buffer-managed ColumnDataCollections of the database of the
+	//! client, which the transformed plan reads by their id. The caller keeps them alive through GetVirtualTables
+	//! until the plan is bound, the bound plan keeps them alive itself
+	void DecodeVirtualTables(ClientContext &context) {
+		virtual_table_context = &context;
+	}
+	//! Transforms Substrait Plan to DuckDB Relation, binding every Relation in the given connection
+	shared_ptr<Relation> TransformPlan(Connection &con_p);
+	//! Transforms Substrait Plan to a DuckDB query without binding it, which lets prepared plans use dynamic parameters
+	//! Returns nullptr for plans only Relations can express (i.e., writes and nested output names)
+	unique_ptr<SelectStatement> TransformPlanToQuery();
+	//! Whether the plan writes to a table, such plans can only be transformed to Relations
+	bool IsWritePlan() const;
+	//! Tables and views the plan reads from
+	const vector<SubstraitTableReference> &GetTableReferences() const {
+		return table_references;
+	}
+	//! The amount of dynamic parameters the plan uses, they become the parameters $1, $2, ...
+	idx_t GetParameterCount() const {
+		return parameter_count;
+	}
+	//! The collections the virtual tables of the plan were decoded into
+	const vector<shared_ptr<ColumnDataCollection>> &GetVirtualTables() const {
+		return virtual_tables;
+	}
+	//! Whether the row groups of byte ranges of files were resolved, which only holds until the files are rewritten
+	bool ReadsFileSplits() const {
+		return reads_file_splits;
+	}
+	//! Whether the plan has hash, merge or nested loop joins, which were translated as logical joins
+	bool HasPhysicalJoins() const {
+		return has_physical_joins;
+	}
 
 private:
 	//! Transforms Substrait Plan Root To a DuckDB Relation
@@ -29,36 +160,168 @@ private:
 	shared_ptr<Relation> TransformSortOp(const substrait::Rel &sop);
 	shared_ptr<Relation> TransformSetOp(const substrait::Rel &sop);
 	shared_ptr<Relation> TransformWriteOp(const substrait::Rel &sop);
+	shared_ptr<Relation> TransformPhysicalJoinOp(const substrait::Rel &sop);
+	shared_ptr<Relation> TransformExchangeOp(const substrait::Rel &sop);
+	shared_ptr<Relation> TransformWindowOp(const substrait::Rel &sop);
+	shared_ptr<Relation> TransformReferenceOp(const substrait::Rel &sop);
+	//! Transforms the input of the root or of a write, as a query that reads the subtrees the plan shares from
+	//! materialized CTEs if it has any
+	shared_ptr<Relation> TransformSharedOp(const substrait::Rel &sop);
+
+	//! Transforms Substrait Plan Root To a DuckDB Query Node, or nullptr if it can't be expressed as one
+	unique_ptr<QueryNode> TransformRootNode(const substrait::RelRoot &sop);
+	//! Transform Substrait Operations to DuckDB Query Nodes, mirroring the query nodes of the Relations above
+	unique_ptr<QueryNode> TransformNode(const substrait::Rel &sop);
+	unique_ptr<QueryNode> TransformJoinNode(const substrait::Rel &sop);
+	unique_ptr<QueryNode> TransformCrossProductNode(const substrait::Rel &sop);
+	unique_ptr<QueryNode> TransformFetchNode(const substrait::Rel &sop);
+	unique_ptr<QueryNode> TransformFilterNode(const substrait::Rel &sop);
+	unique_ptr<QueryNode> TransformProjectNode(const substrait::Rel &sop);
+	unique_ptr<QueryNode> TransformAggregateNode(const substrait::Rel &sop);
+	unique_ptr<QueryNode> TransformReadNode(const substrait::Rel &sop);
+	unique_ptr<QueryNode> TransformSortNode(const substrait::Rel &sop);
+	unique_ptr<QueryNode> TransformSetNode(const substrait::Rel &sop);
+	unique_ptr<QueryNode> TransformPhysicalJoinNode(const substrait::Rel &sop);
+	unique_ptr<QueryNode> TransformExchangeNode(const substrait::Rel &sop);
+	unique_ptr<QueryNode> TransformWindowNode(const substrait::Rel &sop);
+	unique_ptr<QueryNode> TransformReferenceNode(const substrait::Rel &sop);
+	//! The root of the plan, the first of its relations that is one
+	const substrait::RelRoot &GetRoot() const;
+	//! The subtree of the plan a ReferenceRel reads from
+	const substrait::Rel &GetSubtree(const substrait::ReferenceRel &sref);
+	//! Whether the plan has subtrees besides its root
+	bool HasSubtrees() const;
+	//! The name of the CTE a shared subtree is read from, chosen so that it shadows none of the tables the plan reads
+	string SubtreeName(int32_t ordinal);
+	//! Defines the shared subtrees transformed so far as materialized CTEs of the node
+	void AddSharedSubtrees(QueryNode &node);
+	//! Wraps a Query Node in a subquery that can be selected from
+	static unique_ptr<TableRef> ToTableRef(unique_ptr<QueryNode> node, const string &alias);
+
+	//! Transform a physical Substrait join into a logical join, the physical join type is not kept: DuckDB picks the
+	//! join strategy and the build side of a hash join itself
+	SubstraitPhysicalJoin TransformPhysicalJoin(const substrait::Rel &sop);
+	//! Transform the keys and the post join filter of a HashJoinRel or MergeJoinRel into a join condition
+	template <class T>
+	unique_ptr<ParsedExpression> TransformJoinKeys(const T &sjoin);
+	//! Transform the way an exchange distributes its rows into a condition that holds for the rows of the selected
+	//! partition, or nullptr if every row is sent to it. Round robin exchanges hash the column_count columns of
+	//! their input
+	unique_ptr<ParsedExpression> TransformPartitionCondition(const substrait::ExchangeRel &sexchange,
+	                                                         idx_t column_count);
+	//! The amount of columns a Substrait Operation produces, as translated by this class
+	idx_t GetColumnCount(const substrait::Rel &sop);
+
+
+	//! Transform the groupings and measures of a Substrait Aggregate, multiple groupings become grouping sets
+	void TransformAggregateExpressions(const substrait::AggregateRel &saggr, GroupByNode &groups,
+	                                   vector<unique_ptr<ParsedExpression>> &expressions);
 
 	//! Transform Substrait Expressions to DuckDB Expressions
 	unique_ptr<ParsedExpression> TransformExpr(const substrait::Expression &sexpr);
 	static unique_ptr<ParsedExpression> TransformLiteralExpr(const substrait::Expression &sexpr);
-	static unique_ptr<ParsedExpression> TransformSelectionExpr(const substrait::Expression &sexpr);
+	unique_ptr<ParsedExpression> TransformSelectionExpr(const substrait::Expression &sexpr);
+	//! Looks up the table or view a named table refers to, each name is only looked up once per plan
+	const SubstraitNamedTable &ResolveNamedTable(const QualifiedName &name);
+	//! Whether a LocalFiles item is read, only the items of the selected partition are when a partition is selected
+	bool ReadsLocalFile(const substrait::ReadRel_LocalFiles_FileOrFiles &item) const;
+	//! Whether all files of a LocalFiles read are read as a whole
+	bool ReadsWholeFiles(const substrait::ReadRel_LocalFiles &local_files) const;
+	//! Transform a LocalFiles read into a scan per file format, reading only the row groups that start within the
+	//! byte range of an item
+	unique_ptr<SelectNode> TransformLocalFilesNode(const substrait::ReadRel &sget);
+	//! The row ranges of the row groups of a Parquet file that start within a byte range
+	vector<pair<idx_t, idx_t>> GetSplitRowRanges(const string &path, idx_t start, idx_t length);
+	Connection &GetConnection();
+	//! Checks that the partial results of an aggregate are of the types the plan declares, the columns are those of
+	//! the aggregate, its grouping expressions followed by its measures
+	static void VerifyIntermediateTypes(const substrait::AggregateRel &saggr, const vector<LogicalType> &types);
+	//! Binds a copy of a transformed aggregate to verify its intermediate types, if there is a connection to bind
+	//! it with
+	void VerifyIntermediateTypes(const substrait::AggregateRel &saggr, const SelectNode &aggregate);
 	unique_ptr<ParsedExpression> TransformScalarFunctionExpr(const substrait::Expression &sexpr);
 	unique_ptr<ParsedExpression> TransformIfThenExpr(const substrait::Expression &sexpr);
 	unique_ptr<ParsedExpression> TransformCastExpr(const substrait::Expression &sexpr);
 	unique_ptr<ParsedExpression> TransformInExpr(const substrait::Expression &sexpr);
 	unique_ptr<ParsedExpression> TransformNested(const substrait::Expression &sexpr);
+	unique_ptr<ParsedExpression> TransformDynamicParameter(vector<unique_ptr<ParsedExpression>> &children);
+	unique_ptr<ParsedExpression> TransformWindowFunctionExpr(const substrait::Expression &sexpr);
+	unique_ptr<ParsedExpression> TransformSubqueryExpr(const substrait::Expression &sexpr);
+	//! Transform the Substrait Operation of a subquery, its outer references resolve to the operator being transformed
+	unique_ptr<SelectStatement> TransformSubquery(const substrait::Rel &sop);
+	//! Creates the scope of the subqueries in the expressions of a filter or projection
+	SubstraitOuterScope CreateOuterScope();
+	//! Wraps the input of an operator in a subquery that names its columns, if subqueries reference them
+	shared_ptr<Relation> ToScopeRelation(shared_ptr<Relation> input, const SubstraitOuterScope &scope);
+	unique_ptr<TableRef> ToScopeTableRef(unique_ptr<QueryNode> input, const substrait::Rel &sinput,
+	                                     const SubstraitOuterScope &scope, const string &alias);
+	//! Transform a window function expression or a function of a ConsistentPartitionWindowRel, which share the
+	//! function fields but not where the partitions and sorts are kept
+	template <class T>
+	unique_ptr<ParsedExpression>
+	TransformWindowFunction(const T &swindow,
+	                        const google::protobuf::RepeatedPtrField<substrait::Expression> &partitions,
+	                        const google::protobuf::RepeatedPtrField<substrait::SortField> &sorts);
 
 	static void VerifyCorrectExtractSubfield(const string &subfield);
 	static string RemapFunctionName(const string &function_name);
-	static string RemoveExtension(const string &function_name);
 	static LogicalType SubstraitToDuckType(const substrait::Type &s_type);
-	//! Looks up for aggregation function in functions_map
-	string FindFunction(uint64_t id);
+	//! Transform a virtual table with many rows into a scan of a ColumnDataCollection, its literals are decoded
+	//! column by column. Returns nullptr for the virtual tables that are read as VALUES lists, which are all of them
+	//! unless virtual tables are decoded
+	unique_ptr<TableRef> TransformVirtualTable(const substrait::ReadRel &sget);
+	//! Resolves the function declarations of the plan once, so functions are found by their anchor
+	void RegisterFunctions();
+	//! Looks up a function declared by the plan
+	const SubstraitFunction &FindFunction(uint64_t id);
 
 	//! Transform Substrait Sort Order to DuckDB Order
 	OrderByNode TransformOrder(const substrait::SortField &sordf);
-	//! DuckDB Connection
-	Connection &con;
-	//! Substrait Plan
-	substrait::Plan plan;
-	//! Variable used to register functions
-	unordered_map<uint64_t, string> functions_map;
+	//! DuckDB Connection, only used when transforming to Relations
+	optional_ptr<Connection> con;
+	std::function<Connection &()> connection_provider;
+	bool reads_file_splits = false;
+	//! The client virtual tables are decoded in, if they are decoded
+	optional_ptr<ClientContext> virtual_table_context;
+	//! The collections the virtual tables were decoded into, shared with everyone who keeps the plan
+	vector<shared_ptr<ColumnDataCollection>> virtual_tables;
+	//! Arena the Substrait Plan is parsed into, so the whole plan is allocated and released in a few blocks
+	unique_ptr<google::protobuf::Arena> arena;
+	//! Substrait Plan, owned by the arena
+	substrait::Plan &plan;
+	//! Declared functions indexed by their anchor, anchors are usually numbered from 0 or 1
+	vector<SubstraitFunction> functions;
+	//! Declared functions whose anchors are too large to index
+	unordered_map<uint64_t, SubstraitFunction> sparse_functions;
+	static const unordered_map<string, SubstraitFunctionKind> function_kinds;
 	//! Remapped functions with differing names to the correct DuckDB functions
 	//! names
 	static const unordered_map<std::string, std::string> function_names_remap;
 	static const case_insensitive_set_t valid_extract_subfields;
 	vector<ParsedExpression *> struct_expressions;
+	//! Tables and views referenced by read operators
+	vector<SubstraitTableReference> table_references;
+	//! The named tables the Relation backend resolved, by their qualified name
+	unordered_map<string, SubstraitNamedTable> named_tables;
+	bool dynamic_parameters_allowed = false;
+	bool physical_join_replanning_allowed = false;
+	bool has_physical_joins = false;
+	//! One past the highest dynamic parameter index used by the plan
+	idx_t parameter_count = 0;
+	//! The output partition of the exchanges to emit, if only one is emitted
+	optional_idx partition;
+	//! The amount of exchanges the operation that is being transformed is nested in
+	idx_t exchange_depth = 0;
+	//! The scope of the filter or projection whose expressions are being transformed
+	optional_ptr<SubstraitOuterScope> operator_scope;
+	//! The scopes of the operators the subquery being transformed is nested in, the innermost last
+	vector<optional_ptr<SubstraitOuterScope>> outer_scopes;
+	idx_t scope_count = 0;
+	//! The subtrees of the plan that ReferenceRels read, as CTEs in an order they can be defined in
+	vector<pair<string, unique_ptr<QueryNode>>> shared_subtrees;
+	//! Whether the subtree with an ordinal is transformed, subtrees are not while they are being transformed
+	unordered_map<int32_t, bool> subtree_transformed;
+	//! The prefix of the names of the CTEs of shared subtrees, chosen once the first one is named
+	string subtree_prefix;
 };
 } // namespace duckdb
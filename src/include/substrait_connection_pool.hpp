@@ -0,0 +1,58 @@
+//===----------------------------------------------------------------------===//
+//                         DuckDB
+//
+// substrait_connection_pool.hpp
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "duckdb/common/mutex.hpp"
+#include "duckdb/main/client_context_state.hpp"
+#include "duckdb/main/connection.hpp"
+
+namespace duckdb {
+
+class SubstraitConnectionPool;
+
+//! A connection borrowed from a SubstraitConnectionPool, it is given back once it goes out of scope
+class SubstraitConnection {
+public:
+	SubstraitConnection(shared_ptr<SubstraitConnectionPool> pool_p, unique_ptr<Connection> connection_p);
+	~SubstraitConnection();
+
+	SubstraitConnection(const SubstraitConnection &) = delete;
+	SubstraitConnection &operator=(const SubstraitConnection &) = delete;
+
+	Connection &operator*() const {
+		return *connection;
+	}
+	Connection *operator->() const {
+		return connection.get();
+	}
+
+private:
+	shared_ptr<SubstraitConnectionPool> pool;
+	unique_ptr<Connection> connection;
+};
+
+//! Connections used by from_substrait to translate plans and to execute the plans that are not inlined.
+//! The pool is kept per calling client, so creating and registering a connection is not paid on every call.
+class SubstraitConnectionPool : public ClientContextState {
+public:
+	static shared_ptr<SubstraitConnectionPool> Get(ClientContext &context);
+
+	unique_ptr<SubstraitConnection> Acquire(ClientContext &context);
+	void Release(unique_ptr<Connection> connection);
+
+private:
+	static idx_t GetPoolSize(ClientContext &context);
+
+	mutex lock;
+	vector<unique_ptr<Connection>> idle;
+	//! The maximum amount of idle connections that are kept around
+	idx_t pool_size = 0;
+};
+
+} // namespace duckdb
@@ -18,4 +18,8 @@ public:
 	std::string Name() override;
 };
 
+//! Prepares a Substrait plan on the connection, the dynamic parameters of the plan become the parameters $1, $2, ...
+//! of the prepared statement
+unique_ptr<PreparedStatement> SubstraitPrepare(Connection &con, const string &serialized, bool json = false);
+
 } // namespace duckdb
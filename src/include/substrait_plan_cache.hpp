@@ -0,0 +1,101 @@
+//===----------------------------------------------------------------------===//
+//                         DuckDB
+//
+// substrait_plan_cache.hpp
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "from_substrait.hpp"
+
+#include "duckdb/common/list.hpp"
+#include "duckdb/common/mutex.hpp"
+#include "duckdb/common/optional_idx.hpp"
+#include "duckdb/common/types/hash.hpp"
+#include "duckdb/common/unordered_map.hpp"
+#include "duckdb/parser/statement/select_statement.hpp"
+#include "duckdb/storage/object_cache.hpp"
+
+namespace duckdb {
+
+//! A catalog entry a cached plan reads from
+struct SubstraitPlanDependency {
+	string catalog;
+	string schema;
+	string name;
+	//! The oid of the entry when the plan was translated, a new oid means the entry was altered or re-created. Names
+	//! the translator resolved come with the oid it found, the others are resolved when the plan is cached
+	optional_idx oid;
+};
+
+//! A translated from_substrait plan
+struct SubstraitCachedPlan {
+	//! The plan this entry was translated from, used to rule out hash collisions
+	string serialized;
+	bool is_json = false;
+	//! The translated query, copied for every use
+	unique_ptr<SelectStatement> statement;
+	//! The collections the virtual tables of the query reference, shared with every plan prepared from a copy
+	vector<shared_ptr<ColumnDataCollection>> virtual_tables;
+	vector<SubstraitPlanDependency> dependencies;
+	//! The search path the names of the plan were resolved with
+	string search_path;
+	//! Whether the plan has hash, merge or nested loop joins, which DuckDB planned with its own strategy
+	bool physical_joins = false;
+	//! Approximate memory footprint of the entry
+	idx_t size = 0;
+};
+
+struct SubstraitPlanCacheStats {
+	idx_t hits = 0;
+	idx_t misses = 0;
+	idx_t evictions = 0;
+	idx_t invalidations = 0;
+	idx_t entries = 0;
+	idx_t memory_usage = 0;
+	idx_t memory_limit = 0;
+};
+
+//! Per-database LRU cache of translated Substrait plans, bounded by memory usage
+class SubstraitPlanCache : public ObjectCacheEntry {
+public:
+	static constexpr idx_t DEFAULT_MEMORY_LIMIT = 64ULL * 1000ULL * 1000ULL;
+
+	static void Register(ClientContext &context);
+	static shared_ptr<SubstraitPlanCache> Get(ClientContext &context);
+
+	//! Returns the plan translated from the serialized plan, or nullptr if there is no valid entry
+	shared_ptr<SubstraitCachedPlan> Lookup(ClientContext &context, const string &serialized, bool is_json);
+	//! Stores a translated plan, resolving the dependencies the translator left unresolved in the given context
+	void Insert(ClientContext &context, shared_ptr<SubstraitCachedPlan> plan);
+	SubstraitPlanCacheStats GetStats();
+	void Clear();
+
+	static string ObjectType() {
+		return "substrait_plan_cache";
+	}
+	string GetObjectType() override {
+		return ObjectType();
+	}
+
+private:
+	typedef list<shared_ptr<SubstraitCachedPlan>> lru_list_t;
+
+	static idx_t GetMemoryLimit(ClientContext &context);
+	static hash_t GetKey(const string &serialized, bool is_json);
+	static bool IsValid(ClientContext &context, const SubstraitCachedPlan &plan);
+	void Erase(unordered_map<hash_t, lru_list_t::iterator>::iterator entry);
+	void EvictToLimit();
+
+	mutex lock;
+	//! Most recently used entries are at the front
+	lru_list_t lru;
+	unordered_map<hash_t, lru_list_t::iterator> entries;
+	idx_t memory_usage = 0;
+	idx_t memory_limit = DEFAULT_MEMORY_LIMIT;
+	SubstraitPlanCacheStats stats;
+};
+
+} // namespace duckdb
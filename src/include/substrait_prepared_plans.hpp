@@ -0,0 +1,65 @@
+//===----------------------------------------------------------------------===//
+//                         DuckDB
+//
+// substrait_prepared_plans.hpp
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "substrait_connection_pool.hpp"
+
+#include "duckdb/common/case_insensitive_map.hpp"
+#include "duckdb/common/mutex.hpp"
+#include "duckdb/common/unordered_map.hpp"
+#include "duckdb/common/types/column/column_data_collection.hpp"
+#include "duckdb/main/client_context_state.hpp"
+#include "duckdb/main/prepared_statement.hpp"
+
+namespace duckdb {
+
+struct SubstraitCachedPlan;
+
+//! A Substrait plan prepared on a pooled connection
+struct SubstraitPreparedPlan {
+	//! The connection the plan is prepared on, declared first so that it is released last
+	unique_ptr<SubstraitConnection> conn;
+	//! The collections the virtual tables of the plan reference, declared before the plan so that they outlive it
+	vector<shared_ptr<ColumnDataCollection>> virtual_tables;
+	//! The plan, bound and planned once
+	unique_ptr<PreparedStatement> prepared;
+};
+
+//! Plans prepared with substrait_prepare by a client, by the name they were prepared under, and the plans
+//! from_substrait prepared from the plans of the plan cache, for as long as the plan cache keeps them
+class SubstraitPreparedPlans : public ClientContextState {
+public:
+	static shared_ptr<SubstraitPreparedPlans> Get(ClientContext &context);
+
+	//! Stores a prepared plan, replacing any plan prepared under the same name
+	void Insert(const string &name, shared_ptr<SubstraitPreparedPlan> plan);
+	//! Returns the plan prepared under the name, or nullptr if there is none
+	shared_ptr<SubstraitPreparedPlan> Lookup(const string &name);
+	//! Drops the plan prepared under the name, returns whether there was one
+	bool Erase(const string &name);
+
+	//! Stores the plan prepared from a cached plan, replacing any plan prepared from it before
+	void InsertCached(const shared_ptr<SubstraitCachedPlan> &cached_plan, shared_ptr<SubstraitPreparedPlan> plan);
+	//! Returns the plan prepared from the cached plan, or nullptr if there is none or a query of the client still
+	//! uses it, a prepared statement is only executed by one query at a time
+	shared_ptr<SubstraitPreparedPlan> LookupCached(const shared_ptr<SubstraitCachedPlan> &cached_plan);
+
+private:
+	struct CachedPreparedPlan {
+		//! The plan of the plan cache the plan was prepared from, the entry is dropped once it is evicted
+		weak_ptr<SubstraitCachedPlan> cached_plan;
+		shared_ptr<SubstraitPreparedPlan> plan;
+	};
+
+	mutex lock;
+	case_insensitive_map_t<shared_ptr<SubstraitPreparedPlan>> plans;
+	unordered_map<const SubstraitCachedPlan *, CachedPreparedPlan> cached_plans;
+};
+
+} // namespace duckdb
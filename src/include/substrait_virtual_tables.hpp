@@ -0,0 +1,61 @@
+//===----------------------------------------------------------------------===//
+//                         DuckDB
+//
+// substrait_virtual_tables.hpp
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "duckdb/common/mutex.hpp"
+#include "duckdb/common/shared_ptr.hpp"
+#include "duckdb/common/types/column/column_data_collection.hpp"
+#include "duckdb/common/unordered_map.hpp"
+#include "duckdb/main/client_context_state.hpp"
+#include "duckdb/storage/object_cache.hpp"
+
+namespace duckdb {
+
+//! Per-database registry of the collections large virtual tables are decoded into, by the id translated plans read
+//! them with through the substrait_virtual_table table function. The registry only refers to the collections, they
+//! are kept alive by the plans that read them
+class SubstraitVirtualTables : public ObjectCacheEntry {
+public:
+	static void Register(ClientContext &context);
+	static shared_ptr<SubstraitVirtualTables> Get(ClientContext &context);
+
+	//! Registers a collection, returns the id it is read with
+	idx_t Insert(const shared_ptr<ColumnDataCollection> &collection);
+	//! Returns the collection registered under the id, or nullptr if nothing keeps it alive anymore
+	shared_ptr<ColumnDataCollection> Lookup(idx_t id);
+
+	static string ObjectType() {
+		return "substrait_virtual_tables";
+	}
+	string GetObjectType() override {
+		return ObjectType();
+	}
+
+private:
+	mutex lock;
+	idx_t next_id = 0;
+	unordered_map<idx_t, weak_ptr<ColumnDataCollection>> collections;
+};
+
+//! Keeps the collections of a plan that bind_replace inlined alive until the calling query is bound, after which the
+//! scans of the query hold them, or until the query ends
+class SubstraitVirtualTableHolder : public ClientContextState {
+public:
+	static shared_ptr<SubstraitVirtualTableHolder> Get(ClientContext &context);
+
+	void Hold(const vector<shared_ptr<ColumnDataCollection>> &collections_p);
+	void QueryEnd() override {
+		collections.clear();
+	}
+
+private:
+	vector<shared_ptr<ColumnDataCollection>> collections;
+};
+
+} // namespace duckdb
@@ -0,0 +1,62 @@
+#include "substrait_connection_pool.hpp"
+
+#include "duckdb/catalog/catalog_search_path.hpp"
+#include "duckdb/main/client_context.hpp"
+#include "duckdb/main/client_data.hpp"
+
+namespace duckdb {
+
+SubstraitConnection::SubstraitConnection(shared_ptr<SubstraitConnectionPool> pool_p,
+                                         unique_ptr<Connection> connection_p)
+    : pool(std::move(pool_p)), connection(std::move(connection_p)) {
+}
+
+SubstraitConnection::~SubstraitConnection() {
+	pool->Release(std::move(connection));
+}
+
+shared_ptr<SubstraitConnectionPool> SubstraitConnectionPool::Get(ClientContext &context) {
+	return context.registered_state->GetOrCreate<SubstraitConnectionPool>("substrait_connection_pool");
+}
+
+idx_t SubstraitConnectionPool::GetPoolSize(ClientContext &context) {
+	Value pool_size;
+	if (!context.TryGetCurrentSetting("substrait_connection_pool_size", pool_size) || pool_size.IsNull()) {
+		return 0;
+	}
+	return UBigIntValue::Get(pool_size);
+}
+
+unique_ptr<SubstraitConnection> SubstraitConnectionPool::Acquire(ClientContext &context) {
+	auto pool = Get(context);
+	unique_ptr<Connection> connection;
+	{
+		lock_guard<mutex> guard(lock);
+		pool_size = GetPoolSize(context);
+		if (!idle.empty()) {
+			connection = std::move(idle.back());
+			idle.pop_back();
+		}
+	}
+	if (!connection) {
+		connection = make_uniq<Connection>(*context.db);
+	}
+	// names of the plan are resolved like the calling client resolves them, and so to the same catalog and schema
+	auto &search_path = *ClientData::Get(context).catalog_search_path;
+	ClientData::Get(*connection->context)
+	    .catalog_search_path->Set(search_path.GetSetPaths(), CatalogSetPathType::SET_SCHEMAS);
+	return make_uniq<SubstraitConnection>(std::move(pool), std::move(connection));
+}
+
+void SubstraitConnectionPool::Release(unique_ptr<Connection> connection) {
+	if (!connection || connection->HasActiveTransaction()) {
+		// never hand out a connection that is in the middle of a transaction
+		return;
+	}
+	lock_guard<mutex> guard(lock);
+	if (idle.size() < pool_size) {
+		idle.push_back(std::move(connection));
+	}
+}
+
+} // namespace duckdb
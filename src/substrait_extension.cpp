@@ -1,18 +1,34 @@
 #define DUCKDB_EXTENSION_MAIN
 
 #include "from_substrait.hpp"
+#include "substrait_connection_pool.hpp"
 #include "substrait_extension.hpp"
+#include "substrait_plan_cache.hpp"
+#include "substrait_prepared_plans.hpp"
+#include "substrait_virtual_tables.hpp"
 #include "to_substrait.hpp"
 
 #ifndef DUCKDB_AMALGAMATION
+#include "duckdb/catalog/catalog_search_path.hpp"
+#include "duckdb/common/atomic.hpp"
 #include "duckdb/common/enums/optimizer_type.hpp"
 #include "duckdb/common/shared_ptr.hpp"
+#include "duckdb/execution/column_binding_resolver.hpp"
 #include "duckdb/function/table_function.hpp"
+#include "duckdb/optimizer/optimizer.hpp"
+#include "duckdb/parser/parser.hpp"
+#include "duckdb/planner/planner.hpp"
 #include "duckdb/parser/parsed_data/create_table_function_info.hpp"
 #include "duckdb/parser/parsed_data/create_pragma_function_info.hpp"
 #include "duckdb/main/client_context.hpp"
+#include "duckdb/main/client_context_state.hpp"
+#include "duckdb/main/client_data.hpp"
 #include "duckdb/main/config.hpp"
 #include "duckdb/main/connection.hpp"
+#include "duckdb/main/materialized_query_result.hpp"
+#include "duckdb/main/prepared_statement.hpp"
+#include "duckdb/parser/statement/relation_statement.hpp"
+#include "duckdb/parser/tableref/subqueryref.hpp"
 #endif
 
 namespace duckdb {
@@ -24,18 +40,12 @@ struct ToSubstraitFunctionData : public TableFunctionData {
 	//! We will fail the conversion on possible warnings
 	bool strict = false;
 	bool finished = false;
+	//! The DuckDB plan of the query, created in the calling client while binding
+	unique_ptr<LogicalOperator> query_plan;
+	//! The Substrait plan, either as a blob or as JSON
+	string serialized;
 };
 
-static void ToJsonFunctionInternal(ClientContext &context, ToSubstraitFunctionData &data, DataChunk &output,
-                                   Connection &new_conn, unique_ptr<LogicalOperator> &query_plan, string &serialized);
-static void ToSubFunctionInternal(ClientContext &context, ToSubstraitFunctionData &data, DataChunk &output,
-                                  Connection &new_conn, unique_ptr<LogicalOperator> &query_plan, string &serialized);
-
-static void VerifyJSONRoundtrip(unique_ptr<LogicalOperator> &query_plan, Connection &con, ToSubstraitFunctionData &data,
-                                const string &serialized);
-static void VerifyBlobRoundtrip(unique_ptr<LogicalOperator> &query_plan, Connection &con, ToSubstraitFunctionData &data,
-                                const string &serialized);
-
 static void SetOptions(ToSubstraitFunctionData &function, const ClientConfig &config,
                        const named_parameter_map_t &named_params) {
 	bool optimizer_option_set = false;
@@ -60,11 +70,69 @@ static void SetOptions(ToSubstraitFunctionData &function, const ClientConfig &co
 	}
 }
 
-static unique_ptr<ToSubstraitFunctionData> InitToSubstraitFunctionData(const ClientConfig &config,
+//! Applies the client settings required to generate Substrait for as long as it is in scope
+class SubstraitPlanSettings {
+public:
+	explicit SubstraitPlanSettings(ClientContext &context)
+	    : config(ClientConfig::GetConfig(context)), use_replacement_scans(config.use_replacement_scans),
+	      scalar_subquery_error_on_multiple_rows(config.scalar_subquery_error_on_multiple_rows) {
+		config.use_replacement_scans = false;
+		// If error(varchar) gets implemented in substrait this can be removed
+		config.scalar_subquery_error_on_multiple_rows = false;
+	}
+	~SubstraitPlanSettings() {
+		config.use_replacement_scans = use_replacement_scans;
+		config.scalar_subquery_error_on_multiple_rows = scalar_subquery_error_on_multiple_rows;
+	}
+
+private:
+	ClientConfig &config;
+	bool use_replacement_scans;
+	bool scalar_subquery_error_on_multiple_rows;
+};
+
+//! Plans the query in the calling client, and therefore in its transaction
+static unique_ptr<LogicalOperator> ExtractPlan(ClientContext &context, ToSubstraitFunctionData &data) {
+	// We want for sure to disable the internal compression optimizations.
+	// These are DuckDB specific, no other system implements these. Also,
+	// respect the user's settings if they chose to disable any specific optimizers.
+	//
+	// The InClauseRewriter optimization converts large `IN` clauses to a
+	// "mark join" against a `ColumnDataCollection`, which may not make
+	// sense in other systems and would complicate the conversion to Substrait.
+	auto &db_config = DBConfig::GetConfig(context);
+	db_config.options.disabled_optimizers.insert(OptimizerType::IN_CLAUSE);
+	db_config.options.disabled_optimizers.insert(OptimizerType::COMPRESSED_MATERIALIZATION);
+	db_config.options.disabled_optimizers.insert(OptimizerType::MATERIALIZED_CTE);
+
+	Parser parser(context.GetParserOptions());
+	parser.ParseQuery(data.query);
+	if (parser.statements.size() != 1) {
+		throw InvalidInputException("Substrait plans can only be generated for a single statement");
+	}
+
+	SubstraitPlanSettings settings(context);
+	Planner planner(context);
+	planner.CreatePlan(std::move(parser.statements[0]));
+	D_ASSERT(planner.plan);
+	auto plan = std::move(planner.plan);
+	// The user might want to disable the optimizer
+	if (data.enable_optimizer) {
+		Optimizer optimizer(*planner.binder, context);
+		plan = optimizer.Optimize(std::move(plan));
+	}
+	ColumnBindingResolver resolver;
+	resolver.VisitOperator(*plan);
+	plan->ResolveOperatorTypes();
+	return plan;
+}
+
+static unique_ptr<ToSubstraitFunctionData> InitToSubstraitFunctionData(ClientContext &context,
                                                                        TableFunctionBindInput &input) {
 	auto result = make_uniq<ToSubstraitFunctionData>();
 	result->query = input.inputs[0].ToString();
-	SetOptions(*result, config, input.named_parameters);
+	SetOptions(*result, context.config, input.named_parameters);
+	result->query_plan = ExtractPlan(context, *result);
 	return result;
 }
 
@@ -72,19 +140,66 @@ static unique_ptr<FunctionData> ToSubstraitBind(ClientContext &context, TableFun
                                                 vector<LogicalType> &return_types, vector<string> &names) {
 	return_types.emplace_back(LogicalType::BLOB);
 	names.emplace_back("Plan Blob");
-	return InitToSubstraitFunctionData(context.config, input);
+	auto result = InitToSubstraitFunctionData(context, input);
+	DuckDBToSubstrait transformer_d2s(context, *result->query_plan, result->strict);
+	result->serialized = transformer_d2s.SerializeToString();
+	return std::move(result);
 }
 
 static unique_ptr<FunctionData> ToJsonBind(ClientContext &context, TableFunctionBindInput &input,
                                            vector<LogicalType> &return_types, vector<string> &names) {
 	return_types.emplace_back(LogicalType::VARCHAR);
 	names.emplace_back("Json");
-	return InitToSubstraitFunctionData(context.config, input);
+	auto result = InitToSubstraitFunctionData(context, input);
+	DuckDBToSubstrait transformer_d2s(context, *result->query_plan, result->strict);
+	result->serialized = transformer_d2s.SerializeToJson();
+	return std::move(result);
 }
 
 shared_ptr<Relation> SubstraitPlanToDuckDBRel(Connection &conn, const string &serialized, bool json = false) {
-	SubstraitToDuckDB transformer_s2d(conn, serialized, json);
-	return transformer_s2d.TransformPlan();
+	SubstraitToDuckDB transformer_s2d(serialized, json);
+	return transformer_s2d.TransformPlan(conn);
+}
+
+//! Whether DuckDB may plan the hash, merge and nested loop joins of a plan with a strategy and build side of its own
+static bool ReplanPhysicalJoins(ClientContext &context) {
+	Value replan;
+	return context.TryGetCurrentSetting("substrait_replan_physical_joins", replan) && !replan.IsNull() &&
+	       BooleanValue::Get(replan);
+}
+
+//! Prepares a plan on the connection, its large virtual tables are decoded into collections that are kept in
+//! virtual_tables, without it they are read as VALUES lists
+static unique_ptr<PreparedStatement>
+SubstraitPrepareInternal(Connection &con, const string &serialized, bool json, bool replan_physical_joins,
+                         optional_ptr<vector<shared_ptr<ColumnDataCollection>>> virtual_tables) {
+	try {
+		SubstraitToDuckDB transformer(serialized, json);
+		transformer.AllowDynamicParameters();
+		if (replan_physical_joins) {
+			transformer.AllowPhysicalJoinReplanning();
+		}
+		if (virtual_tables) {
+			transformer.DecodeVirtualTables(*con.context);
+		}
+		transformer.SetConnectionProvider([&]() -> Connection & { return con; });
+		unique_ptr<SQLStatement> statement = transformer.TransformPlanToQuery();
+		if (!statement) {
+			// Plans a query can't express are prepared as Relations, which can't have dynamic parameters
+			statement = make_uniq<RelationStatement>(transformer.TransformPlan(con));
+		}
+		if (virtual_tables) {
+			*virtual_tables = transformer.GetVirtualTables();
+		}
+		return con.Prepare(std::move(statement));
+	} catch (std::exception &ex) {
+		return make_uniq<PreparedStatement>(ErrorData(ex));
+	}
+}
+
+unique_ptr<PreparedStatement> SubstraitPrepare(Connection &con, const string &serialized, bool json) {
+	// The caller only keeps the prepared statement, which can't keep the collections of virtual tables alive
+	return SubstraitPrepareInternal(con, serialized, json, ReplanPhysicalJoins(*con.context), nullptr);
 }
 
 static void VerifySubstraitRoundtrip(unique_ptr<LogicalOperator> &query_plan, Connection &con,
@@ -116,45 +231,15 @@ static void VerifySubstraitRoundtrip(unique_ptr<LogicalOperator> &query_plan, Co
 	}
 }
 
-static void VerifyBlobRoundtrip(unique_ptr<LogicalOperator> &query_plan, Connection &con, ToSubstraitFunctionData &data,
-                                const string &serialized) {
-	VerifySubstraitRoundtrip(query_plan, con, data, serialized, false);
-}
-
-static void VerifyJSONRoundtrip(unique_ptr<LogicalOperator> &query_plan, Connection &con, ToSubstraitFunctionData &data,
-                                const string &serialized) {
-	VerifySubstraitRoundtrip(query_plan, con, data, serialized, true);
-}
-
-static DuckDBToSubstrait InitPlanExtractor(ClientContext &context, ToSubstraitFunctionData &data, Connection &new_conn,
-                                           unique_ptr<LogicalOperator> &query_plan) {
-	// The user might want to disable the optimizer of the new connection
-	new_conn.context->config.enable_optimizer = data.enable_optimizer;
-	new_conn.context->config.use_replacement_scans = false;
-
-	// We want for sure to disable the internal compression optimizations.
-	// These are DuckDB specific, no other system implements these. Also,
-	// respect the user's settings if they chose to disable any specific optimizers.
-	//
-	// The InClauseRewriter optimization converts large `IN` clauses to a
-	// "mark join" against a `ColumnDataCollection`, which may not make
-	// sense in other systems and would complicate the conversion to Substrait.
-	set<OptimizerType> disabled_optimizers = DBConfig::GetConfig(context).options.disabled_optimizers;
-	disabled_optimizers.insert(OptimizerType::IN_CLAUSE);
-	disabled_optimizers.insert(OptimizerType::COMPRESSED_MATERIALIZATION);
-	disabled_optimizers.insert(OptimizerType::MATERIALIZED_CTE);
-	DBConfig::GetConfig(*new_conn.context).options.disabled_optimizers = disabled_optimizers;
-
-	query_plan = new_conn.context->ExtractPlan(data.query);
-	return DuckDBToSubstrait(context, *query_plan, data.strict);
-}
+static void VerifyRoundtrips(ClientContext &context, ToSubstraitFunctionData &data) {
+	// Verifying runs the query again, which can't happen on the client that is executing this function
+	auto con = Connection(*context.db);
+	// If error(varchar) gets implemented in substrait this can be removed
+	con.Query("SET scalar_subquery_error_on_multiple_rows=false;");
 
-static void ToSubFunctionInternal(ClientContext &context, ToSubstraitFunctionData &data, DataChunk &output,
-                                  Connection &new_conn, unique_ptr<LogicalOperator> &query_plan, string &serialized) {
-	output.SetCardinality(1);
-	auto transformer_d2s = InitPlanExtractor(context, data, new_conn, query_plan);
-	serialized = transformer_d2s.SerializeToString();
-	output.SetValue(0, 0, Value::BLOB_RAW(serialized));
+	DuckDBToSubstrait transformer_d2s(context, *data.query_plan, data.strict);
+	VerifySubstraitRoundtrip(data.query_plan, con, data, transformer_d2s.SerializeToString(), false);
+	VerifySubstraitRoundtrip(data.query_plan, con, data, transformer_d2s.SerializeToJson(), true);
 }
 
 static void ToSubFunction(ClientContext &context, TableFunctionInput &data_p, DataChunk &output) {
@@ -162,33 +247,14 @@ static void ToSubFunction(ClientContext &context, TableFunctionInput &data_p, Da
 	if (data.finished) {
 		return;
 	}
-	auto new_conn = Connection(*context.db);
-	// If error(varchar) gets implemented in substrait this can be removed
-	new_conn.Query("SET scalar_subquery_error_on_multiple_rows=false;");
-
-	unique_ptr<LogicalOperator> query_plan;
-	string serialized;
-	ToSubFunctionInternal(context, data, output, new_conn, query_plan, serialized);
-
+	output.SetCardinality(1);
+	output.SetValue(0, 0, Value::BLOB_RAW(data.serialized));
 	data.finished = true;
 
 	if (!context.config.query_verification_enabled) {
 		return;
 	}
-	VerifyBlobRoundtrip(query_plan, new_conn, data, serialized);
-	// Also run the ToJson path and verify round-trip for that
-	DataChunk other_output;
-	other_output.Initialize(context, {LogicalType::VARCHAR});
-	ToJsonFunctionInternal(context, data, other_output, new_conn, query_plan, serialized);
-	VerifyJSONRoundtrip(query_plan, new_conn, data, serialized);
-}
-
-static void ToJsonFunctionInternal(ClientContext &context, ToSubstraitFunctionData &data, DataChunk &output,
-                                   Connection &new_conn, unique_ptr<LogicalOperator> &query_plan, string &serialized) {
-	output.SetCardinality(1);
-	auto transformer_d2s = InitPlanExtractor(context, data, new_conn, query_plan);
-	serialized = transformer_d2s.SerializeToJson();
-	output.SetValue(0, 0, serialized);
+	VerifyRoundtrips(context, data);
 }
 
 static void ToJsonFunction(ClientContext &context, TableFunctionInput &data_p, DataChunk &output) {
@@ -196,47 +262,181 @@ static void ToJsonFunction(ClientContext &context, TableFunctionInput &data_p, D
 	if (data.finished) {
 		return;
 	}
-	auto new_conn = Connection(*context.db);
-	// If error(varchar) gets implemented in substrait this can be removed
-	new_conn.Query("SET scalar_subquery_error_on_multiple_rows=false;");
-
-	unique_ptr<LogicalOperator> query_plan;
-	string serialized;
-	ToJsonFunctionInternal(context, data, output, new_conn, query_plan, serialized);
-
+	output.SetCardinality(1);
+	output.SetValue(0, 0, data.serialized);
 	data.finished = true;
 
 	if (!context.config.query_verification_enabled) {
 		return;
 	}
-	VerifyJSONRoundtrip(query_plan, new_conn, data, serialized);
-	// Also run the ToJson path and verify round-trip for that
-	DataChunk other_output;
-	other_output.Initialize(context, {LogicalType::BLOB});
-	ToSubFunctionInternal(context, data, other_output, new_conn, query_plan, serialized);
-	VerifyBlobRoundtrip(query_plan, new_conn, data, serialized);
+	VerifyRoundtrips(context, data);
 }
 
 struct FromSubstraitFunctionData : public TableFunctionData {
 	FromSubstraitFunctionData() = default;
-	shared_ptr<Relation> plan;
-	unique_ptr<QueryResult> res;
-	unique_ptr<Connection> conn;
+	//! The plan, prepared while binding from_substrait or by substrait_prepare
+	shared_ptr<SubstraitPreparedPlan> plan;
+	//! The values of the dynamic parameters of the plan
+	vector<Value> parameters;
 };
 
+struct FromSubstraitGlobalState : public GlobalTableFunctionState {
+	explicit FromSubstraitGlobalState(shared_ptr<ColumnDataCollection> collection_p)
+	    : collection(std::move(collection_p)), next_chunk(0) {
+	}
+	//! The materialized result of the plan, or the collection a virtual table of a plan was decoded into
+	shared_ptr<ColumnDataCollection> collection;
+	//! The next chunk of the result to be emitted
+	atomic<idx_t> next_chunk;
+
+	idx_t MaxThreads() const override {
+		return MaxValue<idx_t>(collection->ChunkCount(), 1);
+	}
+};
+
+struct FromSubstraitLocalState : public LocalTableFunctionState {
+	//! The chunk this thread emitted last, used as its batch index
+	idx_t chunk_index = 0;
+};
+
+//! The search path the client resolves names with, which the pooled connections plans are translated on take over
+static string GetSearchPath(ClientContext &context) {
+	return CatalogSearchEntry::ListToString(ClientData::Get(context).catalog_search_path->GetSetPaths());
+}
+
+static shared_ptr<SubstraitCachedPlan> CreateCachedPlan(ClientContext &context, SubstraitToDuckDB &transformer,
+                                                        const SelectStatement &statement, const string &serialized,
+                                                        bool is_json) {
+	auto result = make_shared_ptr<SubstraitCachedPlan>();
+	result->serialized = serialized;
+	result->is_json = is_json;
+	result->statement = unique_ptr_cast<SQLStatement, SelectStatement>(statement.Copy());
+	result->virtual_tables = transformer.GetVirtualTables();
+	for (auto &table : transformer.GetTableReferences()) {
+		result->dependencies.push_back({table.name.catalog, table.name.schema, table.name.name, table.oid});
+	}
+	result->physical_joins = transformer.HasPhysicalJoins();
+	result->search_path = GetSearchPath(context);
+	return result;
+}
+
+//! Whether a cached plan can be used, plans with physical joins are translated again, and therefore rejected, once
+//! DuckDB may no longer plan them, as are plans whose names were resolved with another search path
+static bool CanUseCachedPlan(ClientContext &context, const SubstraitCachedPlan &plan) {
+	if (plan.search_path != GetSearchPath(context)) {
+		return false;
+	}
+	return !plan.physical_joins || ReplanPhysicalJoins(context);
+}
+
+static unique_ptr<SelectStatement> CreateSelectStatement(Relation &plan) {
+	auto statement = make_uniq<SelectStatement>();
+	statement->node = plan.GetQueryNode();
+	return statement;
+}
+
+//! The output partition of its exchanges the caller asks the plan to emit, if it asks for one
+static optional_idx GetSelectedPartition(const TableFunctionBindInput &input) {
+	auto entry = input.named_parameters.find("partition");
+	if (entry == input.named_parameters.end() || entry->second.IsNull()) {
+		return optional_idx();
+	}
+	return optional_idx(UBigIntValue::Get(entry->second));
+}
+
+//! Whether a translated plan can be cached, plans that emit a single partition are translated every time, as are the
+//! plans that read byte ranges of files, whose row groups change when the files are rewritten, and plans with
+//! dynamic parameters
+static bool CanCachePlan(const SubstraitToDuckDB &transformer, const optional_idx &selected_partition) {
+	return !selected_partition.IsValid() && !transformer.ReadsFileSplits() && transformer.GetParameterCount() == 0;
+}
+
+//! Translates the plan with Relations, plans that write are returned as a Relation in write_plan instead
+static unique_ptr<SelectStatement> TranslateSubstraitPlan(ClientContext &context, SubstraitToDuckDB &transformer,
+                                                          unique_ptr<SubstraitConnection> &conn,
+                                                          shared_ptr<Relation> &write_plan) {
+	// Relations are bound while they are created, which needs a connection of their own
+	if (!conn) {
+		conn = SubstraitConnectionPool::Get(context)->Acquire(context);
+	}
+	auto plan = transformer.TransformPlan(**conn);
+	if (transformer.IsWritePlan()) {
+		write_plan = std::move(plan);
+		return nullptr;
+	}
+	return CreateSelectStatement(*plan);
+}
+
+static void PrepareSubstraitPlan(SubstraitPreparedPlan &plan, unique_ptr<SQLStatement> statement) {
+	plan.prepared = (*plan.conn)->Prepare(std::move(statement));
+	if (plan.prepared->HasError()) {
+		plan.prepared->error.Throw();
+	}
+}
+
 static unique_ptr<FunctionData> SubstraitBind(ClientContext &context, TableFunctionBindInput &input,
                                               vector<LogicalType> &return_types, vector<string> &names, bool is_json) {
 	auto result = make_uniq<FromSubstraitFunctionData>();
-	result->conn = make_uniq<Connection>(*context.db);
 	if (input.inputs[0].IsNull()) {
 		throw BinderException("from_substrait cannot be called with a NULL parameter");
 	}
-	string serialized = input.inputs[0].GetValueUnsafe<string>();
-	result->plan = SubstraitPlanToDuckDBRel(*result->conn, serialized, is_json);
-	for (auto &column : result->plan->Columns()) {
-		return_types.emplace_back(column.Type());
-		names.emplace_back(column.Name());
+	// The plan is read from the string the argument holds, it is only copied when it is cached
+	auto &serialized = StringValue::Get(input.inputs[0]);
+	auto selected_partition = GetSelectedPartition(input);
+	auto plan_cache = SubstraitPlanCache::Get(context);
+	// Plans are cached by their serialization, plans that emit a single partition are never cached
+	shared_ptr<SubstraitCachedPlan> cached_plan;
+	if (!selected_partition.IsValid()) {
+		cached_plan = plan_cache->Lookup(context, serialized, is_json);
+	}
+	if (cached_plan && !CanUseCachedPlan(context, *cached_plan)) {
+		cached_plan = nullptr;
+	}
+	auto prepared_plans = SubstraitPreparedPlans::Get(context);
+	if (cached_plan) {
+		// The statement the cached plan was prepared into by an earlier call of the client is bound and planned
+		// already, as long as its tables weren't altered since, in which case it is bound again when it is executed
+		result->plan = prepared_plans->LookupCached(cached_plan);
+	}
+	if (result->plan) {
+		auto &plan = *result->plan;
+		return_types = plan.prepared->GetTypes();
+		names = plan.prepared->GetNames();
+		return std::move(result);
 	}
+	result->plan = make_shared_ptr<SubstraitPreparedPlan>();
+	auto &plan = *result->plan;
+	plan.conn = SubstraitConnectionPool::Get(context)->Acquire(context);
+	if (cached_plan) {
+		plan.virtual_tables = cached_plan->virtual_tables;
+		PrepareSubstraitPlan(plan, cached_plan->statement->Copy());
+		prepared_plans->InsertCached(cached_plan, result->plan);
+	} else {
+		SubstraitToDuckDB transformer(serialized, is_json);
+		transformer.DecodeVirtualTables(context);
+		if (ReplanPhysicalJoins(context)) {
+			transformer.AllowPhysicalJoinReplanning();
+		}
+		if (selected_partition.IsValid()) {
+			transformer.SelectPartition(selected_partition.GetIndex());
+		}
+		shared_ptr<Relation> write_plan;
+		auto statement = TranslateSubstraitPlan(context, transformer, plan.conn, write_plan);
+		plan.virtual_tables = transformer.GetVirtualTables();
+		if (!statement) {
+			// Writes have side effects and can't be expressed as a cached query
+			PrepareSubstraitPlan(plan, make_uniq<RelationStatement>(write_plan));
+		} else {
+			PrepareSubstraitPlan(plan, statement->Copy());
+			if (CanCachePlan(transformer, selected_partition)) {
+				cached_plan = CreateCachedPlan(context, transformer, *statement, serialized, is_json);
+				prepared_plans->InsertCached(cached_plan, result->plan);
+				plan_cache->Insert(context, std::move(cached_plan));
+			}
+		}
+	}
+	return_types = plan.prepared->GetTypes();
+	names = plan.prepared->GetNames();
 	return std::move(result);
 }
 
@@ -250,16 +450,286 @@ static unique_ptr<FunctionData> FromSubstraitBindJSON(ClientContext &context, Ta
 	return SubstraitBind(context, input, return_types, names, true);
 }
 
+static unique_ptr<TableRef> SubstraitBindReplace(ClientContext &context, TableFunctionBindInput &input, bool is_json) {
+	Value inline_plans;
+	if (context.TryGetCurrentSetting("substrait_inline_plans", inline_plans) && !BooleanValue::Get(inline_plans)) {
+		return nullptr;
+	}
+	if (input.inputs[0].IsNull()) {
+		throw BinderException("from_substrait cannot be called with a NULL parameter");
+	}
+	// The plan is read from the string the argument holds, it is only copied when it is cached
+	auto &serialized = StringValue::Get(input.inputs[0]);
+	auto selected_partition = GetSelectedPartition(input);
+	auto plan_cache = SubstraitPlanCache::Get(context);
+	// Plans are cached by their serialization, plans that emit a single partition are never cached
+	shared_ptr<SubstraitCachedPlan> cached_plan;
+	if (!selected_partition.IsValid()) {
+		cached_plan = plan_cache->Lookup(context, serialized, is_json);
+	}
+	if (cached_plan && !CanUseCachedPlan(context, *cached_plan)) {
+		cached_plan = nullptr;
+	}
+	unique_ptr<SelectStatement> statement;
+	// The scans of the virtual tables of the plan hold their collections once the calling query is bound
+	auto virtual_tables = SubstraitVirtualTableHolder::Get(context);
+	if (cached_plan) {
+		virtual_tables->Hold(cached_plan->virtual_tables);
+		statement = unique_ptr_cast<SQLStatement, SelectStatement>(cached_plan->statement->Copy());
+	} else {
+		unique_ptr<SubstraitConnection> conn;
+		SubstraitToDuckDB transformer(serialized, is_json);
+		if (transformer.IsWritePlan()) {
+			// Writes can't be inlined into a query, they are translated and executed by the table function instead
+			return nullptr;
+		}
+		transformer.DecodeVirtualTables(context);
+		if (ReplanPhysicalJoins(context)) {
+			transformer.AllowPhysicalJoinReplanning();
+		}
+		if (selected_partition.IsValid()) {
+			transformer.SelectPartition(selected_partition.GetIndex());
+		}
+		shared_ptr<Relation> write_plan;
+		statement = TranslateSubstraitPlan(context, transformer, conn, write_plan);
+		D_ASSERT(statement);
+		virtual_tables->Hold(transformer.GetVirtualTables());
+		if (CanCachePlan(transformer, selected_partition)) {
+			plan_cache->Insert(context, CreateCachedPlan(context, transformer, *statement, serialized, is_json));
+		}
+	}
+	// The plan becomes a subquery of the calling query, so it is bound, optimized and executed together with it,
+	// in the calling client and its transaction
+	return make_uniq<SubqueryRef>(std::move(statement));
+}
+
+static unique_ptr<TableRef> FromSubstraitBindReplace(ClientContext &context, TableFunctionBindInput &input) {
+	return SubstraitBindReplace(context, input, false);
+}
+
+static unique_ptr<TableRef> FromSubstraitBindReplaceJSON(ClientContext &context, TableFunctionBindInput &input) {
+	return SubstraitBindReplace(context, input, true);
+}
+
+static unique_ptr<GlobalTableFunctionState> FromSubstraitInitGlobal(ClientContext &context,
+                                                                    TableFunctionInitInput &input) {
+	auto &data = input.bind_data->CastNoConst<FromSubstraitFunctionData>();
+	auto result = data.plan->prepared->Execute(data.parameters, false);
+	if (result->HasError()) {
+		result->ThrowError();
+	}
+	auto &materialized = result->Cast<MaterializedQueryResult>();
+	return make_uniq<FromSubstraitGlobalState>(shared_ptr<ColumnDataCollection>(materialized.TakeCollection()));
+}
+
+static unique_ptr<LocalTableFunctionState> FromSubstraitInitLocal(ExecutionContext &context,
+                                                                  TableFunctionInitInput &input,
+                                                                  GlobalTableFunctionState *global_state) {
+	return make_uniq<FromSubstraitLocalState>();
+}
+
 static void FromSubFunction(ClientContext &context, TableFunctionInput &data_p, DataChunk &output) {
-	auto &data = data_p.bind_data->CastNoConst<FromSubstraitFunctionData>();
-	if (!data.res) {
-		data.res = data.plan->Execute();
+	auto &gstate = data_p.global_state->Cast<FromSubstraitGlobalState>();
+	auto &lstate = data_p.local_state->Cast<FromSubstraitLocalState>();
+	// Every thread claims whole chunks of the result, the chunk index doubles as batch index
+	// so that DuckDB can restore the order of the result when it matters
+	auto chunk_index = gstate.next_chunk++;
+	if (chunk_index >= gstate.collection->ChunkCount()) {
+		return;
+	}
+	lstate.chunk_index = chunk_index;
+	gstate.collection->FetchChunk(chunk_index, output);
+}
+
+static idx_t FromSubstraitGetBatchIndex(ClientContext &context, const FunctionData *bind_data_p,
+                                        LocalTableFunctionState *local_state, GlobalTableFunctionState *global_state) {
+	return local_state->Cast<FromSubstraitLocalState>().chunk_index;
+}
+
+struct SubstraitVirtualTableData : public TableFunctionData {
+	explicit SubstraitVirtualTableData(shared_ptr<ColumnDataCollection> collection_p)
+	    : collection(std::move(collection_p)) {
+	}
+	//! The collection the virtual table was decoded into, kept alive for as long as the bound plan is
+	shared_ptr<ColumnDataCollection> collection;
+
+	unique_ptr<FunctionData> Copy() const override {
+		return make_uniq<SubstraitVirtualTableData>(collection);
+	}
+	bool Equals(const FunctionData &other) const override {
+		return collection == other.Cast<SubstraitVirtualTableData>().collection;
+	}
+};
+
+static unique_ptr<FunctionData> SubstraitVirtualTableBind(ClientContext &context, TableFunctionBindInput &input,
+                                                          vector<LogicalType> &return_types, vector<string> &names) {
+	if (input.inputs[0].IsNull()) {
+		throw BinderException("substrait_virtual_table cannot be called with a NULL id");
+	}
+	auto id = UBigIntValue::Get(input.inputs[0]);
+	auto collection = SubstraitVirtualTables::Get(context)->Lookup(id);
+	if (!collection) {
+		throw BinderException("No Substrait virtual table is registered under id %llu", id);
+	}
+	return_types = collection->Types();
+	for (idx_t i = 0; i < return_types.size(); i++) {
+		names.push_back("col" + to_string(i));
+	}
+	return make_uniq<SubstraitVirtualTableData>(std::move(collection));
+}
+
+static unique_ptr<GlobalTableFunctionState> SubstraitVirtualTableInitGlobal(ClientContext &context,
+                                                                            TableFunctionInitInput &input) {
+	auto &data = input.bind_data->Cast<SubstraitVirtualTableData>();
+	return make_uniq<FromSubstraitGlobalState>(data.collection);
+}
+
+static unique_ptr<NodeStatistics> SubstraitVirtualTableCardinality(ClientContext &context,
+                                                                   const FunctionData *bind_data_p) {
+	auto &data = bind_data_p->Cast<SubstraitVirtualTableData>();
+	return make_uniq<NodeStatistics>(data.collection->Count());
+}
+
+static void SetFromSubstraitCallbacks(TableFunction &function) {
+	function.init_global = FromSubstraitInitGlobal;
+	function.init_local = FromSubstraitInitLocal;
+	function.get_batch_index = FromSubstraitGetBatchIndex;
+}
+
+struct SubstraitPrepareFunctionData : public TableFunctionData {
+	SubstraitPrepareFunctionData() = default;
+	string name;
+	string serialized;
+	bool is_json = false;
+	bool finished = false;
+};
+
+static unique_ptr<FunctionData> SubstraitPrepareBind(ClientContext &context, TableFunctionBindInput &input,
+                                                     vector<LogicalType> &return_types, vector<string> &names,
+                                                     bool is_json) {
+	if (input.inputs[0].IsNull() || input.inputs[1].IsNull()) {
+		throw BinderException("substrait_prepare cannot be called with a NULL parameter");
+	}
+	auto result = make_uniq<SubstraitPrepareFunctionData>();
+	result->name = StringValue::Get(input.inputs[0]);
+	result->serialized = StringValue::Get(input.inputs[1]);
+	result->is_json = is_json;
+	names = {"name", "parameters"};
+	return_types = {LogicalType::VARCHAR, LogicalType::UBIGINT};
+	return std::move(result);
+}
+
+static unique_ptr<FunctionData> SubstraitPrepareBindBlob(ClientContext &context, TableFunctionBindInput &input,
+                                                         vector<LogicalType> &return_types, vector<string> &names) {
+	return SubstraitPrepareBind(context, input, return_types, names, false);
+}
+
+static unique_ptr<FunctionData> SubstraitPrepareBindJSON(ClientContext &context, TableFunctionBindInput &input,
+                                                         vector<LogicalType> &return_types, vector<string> &names) {
+	return SubstraitPrepareBind(context, input, return_types, names, true);
+}
+
+static void SubstraitPrepareFunction(ClientContext &context, TableFunctionInput &data_p, DataChunk &output) {
+	auto &data = data_p.bind_data->CastNoConst<SubstraitPrepareFunctionData>();
+	if (data.finished) {
+		return;
+	}
+	// The plan is prepared on a connection of its own, which it keeps until it is deallocated
+	auto plan = make_shared_ptr<SubstraitPreparedPlan>();
+	plan->conn = SubstraitConnectionPool::Get(context)->Acquire(context);
+	plan->prepared = SubstraitPrepareInternal(**plan->conn, data.serialized, data.is_json,
+	                                          ReplanPhysicalJoins(context), &plan->virtual_tables);
+	if (plan->prepared->HasError()) {
+		plan->prepared->error.Throw();
+	}
+	auto parameter_count = plan->prepared->n_param;
+	SubstraitPreparedPlans::Get(context)->Insert(data.name, std::move(plan));
+
+	output.SetCardinality(1);
+	output.SetValue(0, 0, Value(data.name));
+	output.SetValue(1, 0, Value::UBIGINT(parameter_count));
+	data.finished = true;
+}
+
+static unique_ptr<FunctionData> SubstraitExecuteBind(ClientContext &context, TableFunctionBindInput &input,
+                                                     vector<LogicalType> &return_types, vector<string> &names) {
+	if (input.inputs[0].IsNull()) {
+		throw BinderException("substrait_execute cannot be called with a NULL name");
+	}
+	auto &name = StringValue::Get(input.inputs[0]);
+	auto result = make_uniq<FromSubstraitFunctionData>();
+	result->plan = SubstraitPreparedPlans::Get(context)->Lookup(name);
+	if (!result->plan) {
+		throw BinderException("No Substrait plan was prepared as \"%s\"", name);
+	}
+	for (idx_t i = 1; i < input.inputs.size(); i++) {
+		result->parameters.push_back(input.inputs[i]);
+	}
+	if (result->parameters.size() != result->plan->prepared->n_param) {
+		throw BinderException("The Substrait plan \"%s\" expects %llu parameters, but %llu were given", name,
+		                      result->plan->prepared->n_param, result->parameters.size());
 	}
-	auto result_chunk = data.res->Fetch();
-	if (!result_chunk) {
+	return_types = result->plan->prepared->GetTypes();
+	names = result->plan->prepared->GetNames();
+	return std::move(result);
+}
+
+struct SubstraitDeallocateFunctionData : public TableFunctionData {
+	SubstraitDeallocateFunctionData() = default;
+	string name;
+	bool finished = false;
+};
+
+static unique_ptr<FunctionData> SubstraitDeallocateBind(ClientContext &context, TableFunctionBindInput &input,
+                                                        vector<LogicalType> &return_types, vector<string> &names) {
+	if (input.inputs[0].IsNull()) {
+		throw BinderException("substrait_deallocate cannot be called with a NULL name");
+	}
+	auto result = make_uniq<SubstraitDeallocateFunctionData>();
+	result->name = StringValue::Get(input.inputs[0]);
+	names = {"deallocated"};
+	return_types = {LogicalType::BOOLEAN};
+	return std::move(result);
+}
+
+static void SubstraitDeallocateFunction(ClientContext &context, TableFunctionInput &data_p, DataChunk &output) {
+	auto &data = data_p.bind_data->CastNoConst<SubstraitDeallocateFunctionData>();
+	if (data.finished) {
 		return;
 	}
-	output.Move(*result_chunk);
+	output.SetCardinality(1);
+	output.SetValue(0, 0, Value::BOOLEAN(SubstraitPreparedPlans::Get(context)->Erase(data.name)));
+	data.finished = true;
+}
+
+struct SubstraitPlanCacheStatsData : public TableFunctionData {
+	SubstraitPlanCacheStatsData() = default;
+	bool finished = false;
+};
+
+static unique_ptr<FunctionData> SubstraitPlanCacheStatsBind(ClientContext &context, TableFunctionBindInput &input,
+                                                            vector<LogicalType> &return_types,
+                                                            vector<string> &names) {
+	names = {"hits", "misses", "evictions", "invalidations", "entries", "memory_usage", "memory_limit"};
+	return_types.assign(names.size(), LogicalType::UBIGINT);
+	return make_uniq<SubstraitPlanCacheStatsData>();
+}
+
+static void SubstraitPlanCacheStatsFunction(ClientContext &context, TableFunctionInput &data_p, DataChunk &output) {
+	auto &data = data_p.bind_data->CastNoConst<SubstraitPlanCacheStatsData>();
+	if (data.finished) {
+		return;
+	}
+	auto stats = SubstraitPlanCache::Get(context)->GetStats();
+	output.SetCardinality(1);
+	output.SetValue(0, 0, Value::UBIGINT(stats.hits));
+	output.SetValue(1, 0, Value::UBIGINT(stats.misses));
+	output.SetValue(2, 0, Value::UBIGINT(stats.evictions));
+	output.SetValue(3, 0, Value::UBIGINT(stats.invalidations));
+	output.SetValue(4, 0, Value::UBIGINT(stats.entries));
+	output.SetValue(5, 0, Value::UBIGINT(stats.memory_usage));
+	output.SetValue(6, 0, Value::UBIGINT(stats.memory_limit));
+	data.finished = true;
 }
 
 void InitializeGetSubstrait(const Connection &con) {
@@ -292,6 +762,9 @@ void InitializeFromSubstrait(const Connection &con) {
 	// create the from_substrait table function that allows us to get a query
 	// result from a substrait plan
 	TableFunction from_sub_func("from_substrait", {LogicalType::BLOB}, FromSubFunction, FromSubstraitBind);
+	from_sub_func.bind_replace = FromSubstraitBindReplace;
+	from_sub_func.named_parameters["partition"] = LogicalType::UBIGINT;
+	SetFromSubstraitCallbacks(from_sub_func);
 	CreateTableFunctionInfo from_sub_info(from_sub_func);
 	catalog.CreateTableFunction(*con.context, from_sub_info);
 }
@@ -303,19 +776,97 @@ void InitializeFromSubstraitJSON(const Connection &con) {
 	// result from a substrait plan
 	TableFunction from_sub_func_json("from_substrait_json", {LogicalType::VARCHAR}, FromSubFunction,
 	                                 FromSubstraitBindJSON);
+	from_sub_func_json.bind_replace = FromSubstraitBindReplaceJSON;
+	from_sub_func_json.named_parameters["partition"] = LogicalType::UBIGINT;
+	SetFromSubstraitCallbacks(from_sub_func_json);
 	CreateTableFunctionInfo from_sub_info_json(from_sub_func_json);
 	catalog.CreateTableFunction(*con.context, from_sub_info_json);
 }
 
+void InitializeSubstraitPrepare(const Connection &con) {
+	auto &catalog = Catalog::GetSystemCatalog(*con.context);
+
+	// create the substrait_prepare table functions that prepare a substrait plan under a name, so it can be
+	// executed many times with different parameters by substrait_execute
+	TableFunction prepare_func("substrait_prepare", {LogicalType::VARCHAR, LogicalType::BLOB},
+	                           SubstraitPrepareFunction, SubstraitPrepareBindBlob);
+	CreateTableFunctionInfo prepare_info(prepare_func);
+	catalog.CreateTableFunction(*con.context, prepare_info);
+
+	TableFunction prepare_json_func("substrait_prepare_json", {LogicalType::VARCHAR, LogicalType::VARCHAR},
+	                                SubstraitPrepareFunction, SubstraitPrepareBindJSON);
+	CreateTableFunctionInfo prepare_json_info(prepare_json_func);
+	catalog.CreateTableFunction(*con.context, prepare_json_info);
+
+	TableFunction execute_func("substrait_execute", {LogicalType::VARCHAR}, FromSubFunction, SubstraitExecuteBind);
+	execute_func.varargs = LogicalType::ANY;
+	SetFromSubstraitCallbacks(execute_func);
+	CreateTableFunctionInfo execute_info(execute_func);
+	catalog.CreateTableFunction(*con.context, execute_info);
+
+	TableFunction deallocate_func("substrait_deallocate", {LogicalType::VARCHAR}, SubstraitDeallocateFunction,
+	                              SubstraitDeallocateBind);
+	CreateTableFunctionInfo deallocate_info(deallocate_func);
+	catalog.CreateTableFunction(*con.context, deallocate_info);
+}
+
+void InitializeSubstraitVirtualTable(const Connection &con) {
+	auto &catalog = Catalog::GetSystemCatalog(*con.context);
+
+	SubstraitVirtualTables::Register(*con.context);
+
+	// create the substrait_virtual_table table function that translated plans scan the collections their large
+	// virtual tables were decoded into with, in parallel
+	TableFunction virtual_table_func("substrait_virtual_table", {LogicalType::UBIGINT}, FromSubFunction,
+	                                 SubstraitVirtualTableBind, SubstraitVirtualTableInitGlobal,
+	                                 FromSubstraitInitLocal);
+	virtual_table_func.get_batch_index = FromSubstraitGetBatchIndex;
+	virtual_table_func.cardinality = SubstraitVirtualTableCardinality;
+	CreateTableFunctionInfo virtual_table_info(virtual_table_func);
+	catalog.CreateTableFunction(*con.context, virtual_table_info);
+}
+
+void InitializeSubstraitPlanCache(const Connection &con) {
+	auto &catalog = Catalog::GetSystemCatalog(*con.context);
+
+	auto &config = DBConfig::GetConfig(*con.context);
+	config.AddExtensionOption("substrait_plan_cache_size",
+	                          "Maximum memory used to cache translated from_substrait plans, 0 disables the cache",
+	                          LogicalType::VARCHAR, Value("64MB"));
+	SubstraitPlanCache::Register(*con.context);
+
+	// create the substrait_plan_cache_stats table function that allows us to size the plan cache
+	TableFunction cache_stats_func("substrait_plan_cache_stats", {}, SubstraitPlanCacheStatsFunction,
+	                               SubstraitPlanCacheStatsBind);
+	CreateTableFunctionInfo cache_stats_info(cache_stats_func);
+	catalog.CreateTableFunction(*con.context, cache_stats_info);
+}
+
 void SubstraitExtension::Load(DuckDB &db) {
 	Connection con(db);
 	con.BeginTransaction();
 
+	InitializeSubstraitPlanCache(con);
+	InitializeSubstraitVirtualTable(con);
+
 	InitializeGetSubstrait(con);
 	InitializeGetSubstraitJSON(con);
 
+	auto &config = DBConfig::GetConfig(*con.context);
+	config.AddExtensionOption("substrait_inline_plans",
+	                          "Inline from_substrait plans into the calling query instead of executing them separately",
+	                          LogicalType::BOOLEAN, Value::BOOLEAN(true));
+	config.AddExtensionOption("substrait_replan_physical_joins",
+	                          "Let DuckDB plan the hash, merge and nested loop joins of from_substrait plans with a "
+	                          "join strategy and build side of its own, instead of rejecting them",
+	                          LogicalType::BOOLEAN, Value::BOOLEAN(false));
+	config.AddExtensionOption("substrait_connection_pool_size",
+	                          "Idle connections every client keeps to translate from_substrait plans and to execute "
+	                          "plans that are not inlined, 0 creates a connection per call",
+	                          LogicalType::UBIGINT, Value::UBIGINT(4));
 	InitializeFromSubstrait(con);
 	InitializeFromSubstraitJSON(con);
+	InitializeSubstraitPrepare(con);
 
 	con.Commit();
 }
@@ -0,0 +1,150 @@
+#include "substrait_plan_cache.hpp"
+
+#include "duckdb/catalog/catalog.hpp"
+#include "duckdb/catalog/catalog_entry.hpp"
+#include "duckdb/main/client_context.hpp"
+#include "duckdb/main/config.hpp"
+
+namespace duckdb {
+
+void SubstraitPlanCache::Register(ClientContext &context) {
+	auto &cache = ObjectCache::GetObjectCache(context);
+	if (cache.Get<SubstraitPlanCache>(ObjectType())) {
+		return;
+	}
+	cache.Put(ObjectType(), make_shared_ptr<SubstraitPlanCache>());
+}
+
+shared_ptr<SubstraitPlanCache> SubstraitPlanCache::Get(ClientContext &context) {
+	auto cache = ObjectCache::GetObjectCache(context).Get<SubstraitPlanCache>(ObjectType());
+	if (!cache) {
+		throw InternalException("The Substrait plan cache was not registered");
+	}
+	return cache;
+}
+
+idx_t SubstraitPlanCache::GetMemoryLimit(ClientContext &context) {
+	Value limit;
+	if (!context.TryGetCurrentSetting("substrait_plan_cache_size", limit) || limit.IsNull()) {
+		return DEFAULT_MEMORY_LIMIT;
+	}
+	return DBConfig::ParseMemoryLimit(limit.ToString());
+}
+
+hash_t SubstraitPlanCache::GetKey(const string &serialized, bool is_json) {
+	auto hash = Hash(serialized.c_str(), serialized.size());
+	return CombineHash(hash, Hash(is_json));
+}
+
+bool SubstraitPlanCache::IsValid(ClientContext &context, const SubstraitCachedPlan &plan) {
+	for (auto &dependency : plan.dependencies) {
+		auto entry = Catalog::GetEntry(context, CatalogType::TABLE_ENTRY, dependency.catalog, dependency.schema,
+		                               dependency.name, OnEntryNotFound::RETURN_NULL);
+		if (!entry || entry->oid != dependency.oid.GetIndex()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void SubstraitPlanCache::Erase(unordered_map<hash_t, lru_list_t::iterator>::iterator entry) {
+	memory_usage -= (*entry->second)->size;
+	lru.erase(entry->second);
+	entries.erase(entry);
+}
+
+void SubstraitPlanCache::EvictToLimit() {
+	while (memory_usage > memory_limit && !lru.empty()) {
+		auto &victim = lru.back();
+		auto entry = entries.find(GetKey(victim->serialized, victim->is_json));
+		D_ASSERT(entry != entries.end());
+		Erase(entry);
+		stats.evictions++;
+	}
+}
+
+shared_ptr<SubstraitCachedPlan> SubstraitPlanCache::Lookup(ClientContext &context, const string &serialized,
+                                                           bool is_json) {
+	auto limit = GetMemoryLimit(context);
+	auto hash = GetKey(serialized, is_json);
+
+	lock_guard<mutex> guard(lock);
+	if (limit != memory_limit) {
+		memory_limit = limit;
+		EvictToLimit();
+	}
+	auto entry = entries.find(hash);
+	if (entry == entries.end()) {
+		stats.misses++;
+		return nullptr;
+	}
+	auto plan = *entry->second;
+	if (plan->is_json != is_json || plan->serialized != serialized) {
+		// hash collision, the entry is replaced once the new plan is inserted
+		stats.misses++;
+		return nullptr;
+	}
+	if (!IsValid(context, *plan)) {
+		Erase(entry);
+		stats.invalidations++;
+		stats.misses++;
+		return nullptr;
+	}
+	lru.splice(lru.begin(), lru, entry->second);
+	stats.hits++;
+	return plan;
+}
+
+void SubstraitPlanCache::Insert(ClientContext &context, shared_ptr<SubstraitCachedPlan> plan) {
+	for (auto &dependency : plan->dependencies) {
+		if (dependency.oid.IsValid()) {
+			// resolved by the connection the plan was translated on, so the oid is that of the entry the plan reads
+			continue;
+		}
+		auto entry = Catalog::GetEntry(context, CatalogType::TABLE_ENTRY, dependency.catalog, dependency.schema,
+		                               dependency.name, OnEntryNotFound::RETURN_NULL);
+		if (!entry) {
+			// we can't track this dependency, so we don't cache the plan
+			return;
+		}
+		dependency.oid = entry->oid;
+	}
+	// the translated statement is assumed to take roughly as much memory as the plan it was translated from, the
+	// decoded virtual tables are kept alive by the entry too
+	plan->size = sizeof(SubstraitCachedPlan) + 2 * plan->serialized.size();
+	for (auto &collection : plan->virtual_tables) {
+		plan->size += collection->AllocationSize();
+	}
+	auto hash = GetKey(plan->serialized, plan->is_json);
+
+	lock_guard<mutex> guard(lock);
+	if (plan->size > memory_limit) {
+		return;
+	}
+	auto entry = entries.find(hash);
+	if (entry != entries.end()) {
+		Erase(entry);
+	}
+	memory_usage += plan->size;
+	lru.push_front(std::move(plan));
+	entries[hash] = lru.begin();
+	EvictToLimit();
+}
+
+SubstraitPlanCacheStats SubstraitPlanCache::GetStats() {
+	lock_guard<mutex> guard(lock);
+	auto result = stats;
+	result.entries = entries.size();
+	result.memory_usage = memory_usage;
+	result.memory_limit = memory_limit;
+	return result;
+}
+
+void SubstraitPlanCache::Clear() {
+	lock_guard<mutex> guard(lock);
+	lru.clear();
+	entries.clear();
+	memory_usage = 0;
+}
+
+} // namespace duckdb
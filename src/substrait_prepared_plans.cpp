@@ -0,0 +1,58 @@
+#include "substrait_prepared_plans.hpp"
+#include "substrait_plan_cache.hpp"
+
+#include "duckdb/main/client_context.hpp"
+
+namespace duckdb {
+
+shared_ptr<SubstraitPreparedPlans> SubstraitPreparedPlans::Get(ClientContext &context) {
+	return context.registered_state->GetOrCreate<SubstraitPreparedPlans>("substrait_prepared_plans");
+}
+
+void SubstraitPreparedPlans::Insert(const string &name, shared_ptr<SubstraitPreparedPlan> plan) {
+	lock_guard<mutex> guard(lock);
+	plans[name] = std::move(plan);
+}
+
+shared_ptr<SubstraitPreparedPlan> SubstraitPreparedPlans::Lookup(const string &name) {
+	lock_guard<mutex> guard(lock);
+	auto entry = plans.find(name);
+	if (entry == plans.end()) {
+		return nullptr;
+	}
+	return entry->second;
+}
+
+bool SubstraitPreparedPlans::Erase(const string &name) {
+	lock_guard<mutex> guard(lock);
+	return plans.erase(name) > 0;
+}
+
+void SubstraitPreparedPlans::InsertCached(const shared_ptr<SubstraitCachedPlan> &cached_plan,
+                                          shared_ptr<SubstraitPreparedPlan> plan) {
+	lock_guard<mutex> guard(lock);
+	// the plans prepared from evicted plans are dropped, which returns their connections to the pool
+	for (auto entry = cached_plans.begin(); entry != cached_plans.end();) {
+		if (entry->second.cached_plan.expired()) {
+			entry = cached_plans.erase(entry);
+		} else {
+			entry++;
+		}
+	}
+	cached_plans[cached_plan.get()] = {cached_plan, std::move(plan)};
+}
+
+shared_ptr<SubstraitPreparedPlan>
+SubstraitPreparedPlans::LookupCached(const shared_ptr<SubstraitCachedPlan> &cached_plan) {
+	lock_guard<mutex> guard(lock);
+	auto entry = cached_plans.find(cached_plan.get());
+	if (entry == cached_plans.end() || entry->second.cached_plan.lock() != cached_plan) {
+		return nullptr;
+	}
+	if (entry->second.plan.use_count() > 1) {
+		return nullptr;
+	}
+	return entry->second.plan;
+}
+
+} // namespace duckdb
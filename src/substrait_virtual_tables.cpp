@@ -0,0 +1,55 @@
+#include "substrait_virtual_tables.hpp"
+
+#include "duckdb/main/client_context.hpp"
+
+namespace duckdb {
+
+void SubstraitVirtualTables::Register(ClientContext &context) {
+	auto &cache = ObjectCache::GetObjectCache(context);
+	if (cache.Get<SubstraitVirtualTables>(ObjectType())) {
+		return;
+	}
+	cache.Put(ObjectType(), make_shared_ptr<SubstraitVirtualTables>());
+}
+
+shared_ptr<SubstraitVirtualTables> SubstraitVirtualTables::Get(ClientContext &context) {
+	auto registry = ObjectCache::GetObjectCache(context).Get<SubstraitVirtualTables>(ObjectType());
+	if (!registry) {
+		throw InternalException("The Substrait virtual table registry was not registered");
+	}
+	return registry;
+}
+
+idx_t SubstraitVirtualTables::Insert(const shared_ptr<ColumnDataCollection> &collection) {
+	lock_guard<mutex> guard(lock);
+	// the ids of collections that are no longer read are dropped, so the registry only grows with the live plans
+	for (auto entry = collections.begin(); entry != collections.end();) {
+		if (entry->second.expired()) {
+			entry = collections.erase(entry);
+		} else {
+			entry++;
+		}
+	}
+	auto id = next_id++;
+	collections[id] = collection;
+	return id;
+}
+
+shared_ptr<ColumnDataCollection> SubstraitVirtualTables::Lookup(idx_t id) {
+	lock_guard<mutex> guard(lock);
+	auto entry = collections.find(id);
+	if (entry == collections.end()) {
+		return nullptr;
+	}
+	return entry->second.lock();
+}
+
+shared_ptr<SubstraitVirtualTableHolder> SubstraitVirtualTableHolder::Get(ClientContext &context) {
+	return context.registered_state->GetOrCreate<SubstraitVirtualTableHolder>("substrait_virtual_table_holder");
+}
+
+void SubstraitVirtualTableHolder::Hold(const vector<shared_ptr<ColumnDataCollection>> &collections_p) {
+	collections.insert(collections.end(), collections_p.begin(), collections_p.end());
+}
+
+} // namespace duckdb
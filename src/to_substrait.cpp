@@ -657,13 +657,26 @@ vector<string> DuckDBToSubstrait::DepthFirstNames(const LogicalType &type) {
 }
 
 void DuckDBToSubstrait::DepthFirstNamesRecurse(vector<string> &names, const LogicalType &type) {
-	if (type.id() == LogicalTypeId::STRUCT) {
+	switch (type.id()) {
+	case LogicalTypeId::STRUCT: {
 		// Recurse this
 		idx_t struct_size = StructType::GetChildCount(type);
 		for (idx_t i = 0; i < struct_size; i++) {
 			names.emplace_back(StructType::GetChildName(type, i));
 			DepthFirstNamesRecurse(names, StructType::GetChildType(type, i));
 		}
+		break;
+	}
+	case LogicalTypeId::LIST:
+		// The structs within lists and maps name their fields too
+		DepthFirstNamesRecurse(names, ListType::GetChildType(type));
+		break;
+	case LogicalTypeId::MAP:
+		DepthFirstNamesRecurse(names, MapType::KeyType(type));
+		DepthFirstNamesRecurse(names, MapType::ValueType(type));
+		break;
+	default:
+		break;
 	}
 }
 
@@ -1202,6 +1215,21 @@ substrait::Type DuckDBToSubstrait::DuckToSubstraitType(const LogicalType &type,
 		s_type.set_allocated_struct_(struct_type);
 		return s_type;
 	}
+	case LogicalTypeId::LIST: {
+		auto list_type = new substrait::Type_List;
+		list_type->set_nullability(type_nullability);
+		*list_type->mutable_type() = DuckToSubstraitType(ListType::GetChildType(type));
+		s_type.set_allocated_list(list_type);
+		return s_type;
+	}
+	case LogicalTypeId::MAP: {
+		auto map_type = new substrait::Type_Map;
+		map_type->set_nullability(type_nullability);
+		*map_type->mutable_key() = DuckToSubstraitType(MapType::KeyType(type), nullptr, true);
+		*map_type->mutable_value() = DuckToSubstraitType(MapType::ValueType(type));
+		s_type.set_allocated_map(map_type);
+		return s_type;
+	}
 	default:
 		throw NotImplementedException("Logical Type " + type.ToString() +
 		                              " not implemented as Substrait Schema Result.");
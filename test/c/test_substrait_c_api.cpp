@@ -1,6 +1,7 @@
 #include "catch.hpp"
 #include "test_helpers.hpp"
 #include "duckdb/main/connection_manager.hpp"
+#include "substrait_extension.hpp"
 
 #include <chrono>
 #include <thread>
@@ -293,3 +294,60 @@ TEST_CASE("Test C DeleteRows with Substrait API", "[substrait-api]") {
 	REQUIRE(CHECK_COLUMN(result, 2, {1, 2, 3}));
 	REQUIRE(CHECK_COLUMN(result, 3, {120000, 80000, 95000}));
 }
+
+TEST_CASE("Test C Prepare with Substrait API", "[substrait-api]") {
+	DuckDB db(nullptr);
+	Connection con(db);
+
+	CreateEmployeeTable(con);
+
+	auto proto = con.GetSubstrait("SELECT name FROM employees WHERE employee_id = 2");
+	auto prepared = SubstraitPrepare(con, proto);
+	REQUIRE(!prepared->HasError());
+	auto result = prepared->Execute();
+	REQUIRE(CHECK_COLUMN(result, 0, {"Jane Smith"}));
+
+	// the prepared plan is planned once and can be executed again
+	result = prepared->Execute();
+	REQUIRE(CHECK_COLUMN(result, 0, {"Jane Smith"}));
+
+	REQUIRE(SubstraitPrepare(con, "this is not valid")->HasError());
+}
+
+TEST_CASE("Test C Prepare with dynamic parameters with Substrait API", "[substrait-api]") {
+	DuckDB db(nullptr);
+	Connection con(db);
+
+	CreateEmployeeTable(con);
+
+	// SELECT * FROM employees WHERE employee_id = $1
+	string plan =
+	    R"({"extensions":[{"extensionFunction":{"functionAnchor":1,"name":"equal:any_any"}},)"
+	    R"({"extensionFunction":{"functionAnchor":2,"name":"dynamic_parameter:i32"}}],)"
+	    R"("relations":[{"root":{"input":{"filter":{"input":{"read":{"baseSchema":)"
+	    R"({"names":["employee_id","name","department_id","salary"],"struct":{"types":[)"
+	    R"({"i32":{"nullability":"NULLABILITY_REQUIRED"}},{"string":{"nullability":"NULLABILITY_NULLABLE"}},)"
+	    R"({"i32":{"nullability":"NULLABILITY_NULLABLE"}},)"
+	    R"({"decimal":{"scale":2,"precision":10,"nullability":"NULLABILITY_NULLABLE"}}],)"
+	    R"("nullability":"NULLABILITY_REQUIRED"}},"namedTable":{"names":["employees"]}}},)"
+	    R"("condition":{"scalarFunction":{"functionReference":1,"arguments":[)"
+	    R"({"value":{"selection":{"directReference":{"structField":{"field":0}},"rootReference":{}}}},)"
+	    R"({"value":{"scalarFunction":{"functionReference":2,"arguments":[{"value":{"literal":{"i32":0}}}]}}}]}}}},)"
+	    R"("names":["employee_id","name","department_id","salary"]}}]})";
+
+	auto prepared = SubstraitPrepare(con, plan, true);
+	REQUIRE(!prepared->HasError());
+	REQUIRE(prepared->n_param == 1);
+
+	// the parameter is bound every time the plan is executed
+	duckdb::vector<Value> values {Value::INTEGER(2)};
+	auto result = prepared->Execute(values, false);
+	REQUIRE(CHECK_COLUMN(result, 1, {"Jane Smith"}));
+
+	values = {Value::INTEGER(4)};
+	result = prepared->Execute(values, false);
+	REQUIRE(CHECK_COLUMN(result, 1, {"Bob Brown"}));
+
+	// plans with dynamic parameters are rejected when they are not prepared
+	REQUIRE_THROWS(con.FromSubstraitJSON(plan));
+}